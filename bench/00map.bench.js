@@ -10,6 +10,7 @@ module.exports = function (type, size, fn) {
     'simple': {
       exprJS: (x) => (x * x + 2 * x + 1),
       exprExprTkI: new e[type]('x*x + 2*x + 1', ['x']),
+      exprExprTkB: new e[type]('x*x + 2*x + 1', ['x'], undefined, { backend: 'block' }),
       exprExprTkE: new e[type](
         'for (var i := 0; i < a1[]; i += 1) { var x := a1[i]; a2[i] := x*x + 2*x + 1; };',
         [], { a1: size, a2: size }),
@@ -17,6 +18,7 @@ module.exports = function (type, size, fn) {
     'complex': {
       exprJS: (x) => (2 * Math.cos(x) / (Math.sqrt(x) + 1)),
       exprExprTkI: new e[type]('2 * cos(x) / (sqrt(x) + 1)', ['x']),
+      exprExprTkB: new e[type]('2 * cos(x) / (sqrt(x) + 1)', ['x'], undefined, { backend: 'block' }),
       exprExprTkE: new e[type](
         'for (var i := 0; i < a1[]; i += 1) { var x := a1[i]; a2[i] := 2 * cos(x) / (sqrt(x) + 1); };',
         [], { a1: size, a2: size }),
@@ -27,7 +29,7 @@ module.exports = function (type, size, fn) {
 
   const allocator = global[type + 'Array'];
 
-  const { exprJS, exprExprTkE, exprExprTkI} = fns[fn];
+  const { exprJS, exprExprTkE, exprExprTkI, exprExprTkB } = fns[fn];
 
   const a1 = new allocator(size);
 
@@ -61,11 +63,21 @@ module.exports = function (type, size, fn) {
       exprExprTkE.eval(a1, r);
       assert.equal(r[4], exprJS(4));
     }),
+    b.add('ExprTk.js map() block traversal', () => {
+      const r = exprExprTkB.map(a1, 'x');
+      assert.instanceOf(r, allocator);
+      assert.equal(r[4], exprJS(4));
+    }),
     b.add('ExprTk.js cwise() traversal', () => {
       const r = exprExprTkI.cwise({ x: a1 });
       assert.instanceOf(r, allocator);
       assert.equal(r[4], exprJS(4));
     }),
+    b.add('ExprTk.js cwise() block traversal', () => {
+      const r = exprExprTkB.cwise({ x: a1 });
+      assert.instanceOf(r, allocator);
+      assert.equal(r[4], exprJS(4));
+    }),
     b.add(`ExprTk.js map() ${cpus}-way MP traversal`, () => {
       const r = exprExprTkI.map(cpus, a1, 'x');
       assert.instanceOf(r, allocator);
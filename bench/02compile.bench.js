@@ -0,0 +1,63 @@
+const b = require('benny');
+const { assert } = require('chai');
+const e = require('..');
+
+// You should probably read the notes in `Performance.md`
+
+// A long multi-statement expression where parsing and optimizing dominate
+function longExpression(statements) {
+  let text = 'var y0 := x;';
+  for (let i = 1; i < statements; i++)
+    text += ` var y${i} := y${i - 1} * 0.5 + x * ${i} - min(y${i - 1}, ${i});`;
+  return text + ` y${statements - 1};`;
+}
+
+module.exports = function (type, size, fn) {
+  // The compilation time does not depend on the array size
+  if (size !== 1024) return;
+
+  if (typeof global.gc !== 'function') {
+    console.log('compilation benchmark requires --expose-gc');
+    return;
+  }
+
+  const texts = {
+    'simple': 'x*x + 2*x + 1',
+    'complex': longExpression(64)
+  };
+  const text = texts[fn];
+  const expr = e[type];
+  const cacheSize = expr.cacheSize;
+  const ref = new expr(text, ['x']).eval(3);
+
+  // The garbage collection is included in both cases,
+  // the difference is the cost of parsing and optimizing the expression
+  // (the finalizers run on the next event loop iteration)
+  const collect = () => {
+    global.gc();
+    return new Promise((resolve) => setImmediate(resolve));
+  };
+
+  return b.suite(
+    `${fn} function, ${type} compilation of one instance`,
+
+    b.add('ExprTk.js reparse', async () => {
+      expr.cacheSize = 0;
+      let x = new expr(text, ['x']);
+      assert.equal(x.eval(3), ref);
+      x = null;
+      await collect();
+    }),
+    b.add('ExprTk.js recycled from the cache', async () => {
+      expr.cacheSize = cacheSize;
+      let x = new expr(text, ['x']);
+      assert.equal(x.eval(3), ref);
+      x = null;
+      await collect();
+    }),
+    b.cycle(),
+    b.complete(() => {
+      expr.cacheSize = cacheSize;
+    })
+  );
+};
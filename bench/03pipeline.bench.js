@@ -0,0 +1,55 @@
+const b = require('benny');
+const { assert } = require('chai');
+const e = require('..');
+const cpus = require('os').cpus().length;
+
+// You should probably read the notes in `Performance.md`
+
+module.exports = function (type, size, fn) {
+  const stages = {
+    'simple': [['x + 1', 'x'], ['y * 2', 'y'], ['z - 3', 'z'], ['w / 2', 'w']],
+    'complex': [['2 * cos(x)', 'x'], ['y / (sqrt(abs(y)) + 1)', 'y'], ['z * z', 'z'], ['atan(w)', 'w']]
+  };
+
+  if (type.match(/[Ii]nt/) && fn == 'complex') return;
+
+  const allocator = global[type + 'Array'];
+  const expr = e[type];
+  const exprs = stages[fn].map(([text, it]) => new expr(text, [it]));
+  const pipeline = expr.pipeline(exprs.map((x, i) => [x, stages[fn][i][1]]).flat());
+
+  const a1 = new allocator(size);
+  for (let i = 0; i < size; i++) a1[i] = i;
+
+  const chain = (threads) => {
+    let r = a1;
+    for (let i = 0; i < exprs.length; i++)
+      r = exprs[i].map(threads, r, stages[fn][i][1]);
+    return r;
+  };
+  const ref = chain(1);
+
+  // target array allocation is included
+  return b.suite(
+    `${fn} function, ${exprs.length} stages ${type} arrays of ${size} elements`,
+
+    b.add('ExprTk.js chained map()', () => {
+      const r = chain(1);
+      assert.equal(r[4], ref[4]);
+    }),
+    b.add('ExprTk.js pipeline map()', () => {
+      const r = pipeline.map(a1, 'x');
+      assert.equal(r[4], ref[4]);
+    }),
+    b.add(`ExprTk.js chained map() ${cpus}-way MP`, () => {
+      const r = chain(cpus);
+      assert.equal(r[4], ref[4]);
+    }),
+    b.add(`ExprTk.js pipeline map() ${cpus}-way MP`, () => {
+      const r = pipeline.map(cpus, a1, 'x');
+      assert.equal(r[4], ref[4]);
+    }),
+    b.cycle(),
+    b.complete()
+  );
+};
@@ -0,0 +1,46 @@
+const b = require('benny');
+const { assert } = require('chai');
+const e = require('..');
+const cpus = require('os').cpus().length;
+
+// You should probably read the notes in `Performance.md`
+
+// Thousands of concurrent tiny async evaluations where the cost
+// of the scheduler dominates the cost of the evaluation
+module.exports = function (type, size, fn) {
+  // The number of concurrent calls does not depend on the array size
+  if (size !== 1024) return;
+
+  const texts = {
+    'simple': 'x*x + 2*x + 1',
+    'complex': '2 * cos(x) / (sqrt(x) + 1)'
+  };
+
+  if (type.match(/[Ii]nt/) && fn == 'complex') return;
+
+  const expr = e[type];
+  const calls = 4096;
+  const one = new expr(texts[fn], ['x']);
+  const many = [];
+  for (let i = 0; i < cpus * 4; i++) many.push(new expr(texts[fn], ['x']));
+  const ref = one.eval(4);
+
+  return b.suite(
+    `${fn} function, ${type} ${calls} concurrent evalAsync() on ${cpus} threads`,
+
+    b.add('ExprTk.js evalAsync() on one Expression', async () => {
+      const q = [];
+      for (let i = 0; i < calls; i++) q.push(one.evalAsync(4));
+      const r = await Promise.all(q);
+      assert.equal(r[calls - 1], ref);
+    }),
+    b.add(`ExprTk.js evalAsync() on ${many.length} Expressions`, async () => {
+      const q = [];
+      for (let i = 0; i < calls; i++) q.push(many[i % many.length].evalAsync(4));
+      const r = await Promise.all(q);
+      assert.equal(r[calls - 1], ref);
+    }),
+    b.cycle(),
+    b.complete()
+  );
+};
@@ -0,0 +1,52 @@
+const b = require('benny');
+const { assert } = require('chai');
+const e = require('..');
+const cpus = require('os').cpus().length;
+
+// You should probably read the notes in `Performance.md`
+
+// A loop whose number of iterations depends on the input which grows
+// along the array, with the static schedule the last thread gets
+// most of the work
+module.exports = function (type, size, fn) {
+  const texts = {
+    'simple': 'var s := 0; for (var i := 0; i < x; i += 1) { s += i }; s',
+    'complex': 'var s := 0; for (var i := 0; i < x; i += 1) { s += sqrt(i) }; s'
+  };
+
+  if (type.match(/[Ii]nt/) && fn == 'complex') return;
+
+  const allocator = global[type + 'Array'];
+  const expr = e[type];
+  const exprStatic = new expr(texts[fn], ['x']);
+  const exprDynamic = new expr(texts[fn], ['x'], undefined, { schedule: 'dynamic' });
+
+  // keep the total number of iterations reasonable for the large arrays
+  const maxIterations = Math.min(1024, Math.floor((1 << 24) / size));
+  const a1 = new allocator(size);
+  for (let i = 0; i < size; i++) a1[i] = Math.floor(i * maxIterations / size);
+  const ref = exprStatic.map(a1, 'x');
+
+  return b.suite(
+    `${fn} function, data-dependent loop, map() ${type} arrays of ${size} elements`,
+
+    b.add(`ExprTk.js map() ${cpus}-way MP static schedule`, () => {
+      const r = exprStatic.map(cpus, a1, 'x');
+      assert.equal(r[size - 1], ref[size - 1]);
+    }),
+    b.add(`ExprTk.js map() ${cpus}-way MP dynamic schedule`, () => {
+      const r = exprDynamic.map(cpus, a1, 'x');
+      assert.equal(r[size - 1], ref[size - 1]);
+    }),
+    b.add(`ExprTk.js cwise() ${cpus}-way MP static schedule`, () => {
+      const r = exprStatic.cwise(cpus, { x: a1 });
+      assert.equal(r[size - 1], ref[size - 1]);
+    }),
+    b.add(`ExprTk.js cwise() ${cpus}-way MP dynamic schedule`, () => {
+      const r = exprDynamic.cwise(cpus, { x: a1 });
+      assert.equal(r[size - 1], ref[size - 1]);
+    }),
+    b.cycle(),
+    b.complete()
+  );
+};
@@ -0,0 +1,62 @@
+const b = require('benny');
+const { assert } = require('chai');
+const e = require('..');
+const cpus = require('os').cpus().length;
+
+// You should probably read the notes in `Performance.md`
+
+// A memory-bound cwise() on arrays much larger than the caches
+// with and without pinning the worker threads, the difference
+// appears only on multi-socket (NUMA) hosts
+module.exports = function (type, size, fn) {
+  // The arrays must be much larger than the caches
+  if (size !== 1024 * 1024) return;
+
+  const texts = {
+    'simple': 'a + b',
+    'complex': 'a * b + a / (b + 1)'
+  };
+
+  if (type.match(/[Ii]nt/) && fn == 'complex') return;
+
+  const expr = e[type];
+  const len = size * 16;
+  const fill = new expr('x % 255', ['x']);
+  const sum = new expr(texts[fn], ['a', 'b']);
+  const pinned = expr.pinThreads;
+
+  // The arrays are created by the worker threads with each setting,
+  // so that their pages are first-touched the same way they will be used
+  const setup = (pin) => {
+    expr.pinThreads = pin;
+    const index = new (global[type + 'Array'])(len);
+    for (let i = 0; i < len; i++) index[i] = i;
+    const a = fill.map(cpus, index, 'x');
+    const b = fill.map(cpus, index, 'x');
+    const out = fill.map(cpus, index, 'x');
+    return { a, b, out };
+  };
+
+  return b.suite(
+    `${fn} function, cwise() ${type} arrays of ${len} elements on ${cpus} threads`,
+
+    b.add(`ExprTk.js cwise() ${cpus}-way MP unpinned threads`, () => {
+      const { a, b, out } = setup(false);
+      return () => {
+        const r = sum.cwise(cpus, { a, b }, out);
+        assert.strictEqual(r, out);
+      };
+    }),
+    b.add(`ExprTk.js cwise() ${cpus}-way MP pinned threads`, () => {
+      const { a, b, out } = setup(true);
+      return () => {
+        const r = sum.cwise(cpus, { a, b }, out);
+        assert.strictEqual(r, out);
+      };
+    }),
+    b.cycle(),
+    b.complete(() => {
+      expr.pinThreads = pinned;
+    })
+  );
+};
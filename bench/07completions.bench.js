@@ -0,0 +1,47 @@
+const b = require('benny');
+const { assert } = require('chai');
+const e = require('..');
+const cpus = require('os').cpus().length;
+
+// You should probably read the notes in `Performance.md`
+
+// The throughput of trivial async evaluations where the cost of delivering
+// the completions to the main thread dominates everything else
+module.exports = function (type, size, fn) {
+  // The number of calls does not depend on the array size
+  if (size !== 1024) return;
+  // The expression is irrelevant here
+  if (fn !== 'simple') return;
+
+  const expr = e[type];
+  const burst = 16384;
+  const chain = 1024;
+  const tiny = new expr('x + 1', ['x']);
+
+  return b.suite(
+    `${type} trivial evalAsync() completions on ${cpus} threads`,
+
+    b.add(`ExprTk.js ${burst} concurrent evalAsync() Promises`, async () => {
+      const q = [];
+      for (let i = 0; i < burst; i++) q.push(tiny.evalAsync(1));
+      const r = await Promise.all(q);
+      assert.equal(r[burst - 1], 2);
+    }),
+    b.add(`ExprTk.js ${burst} concurrent evalAsync() callbacks`, () => new Promise((resolve, reject) => {
+      let done = 0;
+      const cb = (err, r) => {
+        if (err || r !== 2) reject(err || new Error('wrong result'));
+        if (++done === burst) resolve();
+      };
+      for (let i = 0; i < burst; i++) tiny.evalAsync(1, cb);
+    })),
+    b.add(`ExprTk.js ${chain} sequential evalAsync()`, async () => {
+      let x = 0;
+      // eslint-disable-next-line no-await-in-loop
+      for (let i = 0; i < chain; i++) x = await tiny.evalAsync(x);
+      assert.equal(x, chain);
+    }),
+    b.cycle(),
+    b.complete()
+  );
+};
@@ -0,0 +1,47 @@
+const b = require('benny');
+const { assert } = require('chai');
+const e = require('..');
+const cpus = require('os').cpus().length;
+
+// You should probably read the notes in `Performance.md`
+
+// The latency of synchronous multithreaded map() calls on arrays
+// small enough for the synchronization to be a large part of the time
+module.exports = async function (type, size, fn) {
+  // The array sizes are chosen here
+  if (size !== 1024) return;
+
+  const texts = {
+    'simple': 'x*x + 2*x + 1',
+    'complex': '2 * cos(x) / (sqrt(x) + 1)'
+  };
+
+  if (type.match(/[Ii]nt/) && fn == 'complex') return;
+
+  const allocator = global[type + 'Array'];
+  const expr = e[type];
+  const fx = new expr(texts[fn], ['x']);
+  const threads = [...new Set([2, Math.min(4, cpus), cpus])].filter((n) => n <= fx.maxParallel);
+
+  for (const len of [1024, 4096, 16384, 65536]) {
+    const a = new allocator(len);
+    for (let i = 0; i < len; i++) a[i] = i;
+    const ref = fx.map(a, 'x');
+
+    // eslint-disable-next-line no-await-in-loop
+    await b.suite(
+      `${fn} function, synchronous map() latency on ${type} arrays of ${len} elements`,
+
+      b.add('ExprTk.js map() single-threaded', () => {
+        const r = fx.map(a, 'x');
+        assert.equal(r[len - 1], ref[len - 1]);
+      }),
+      ...threads.map((n) => b.add(`ExprTk.js map() ${n}-way MP`, () => {
+        const r = fx.map(n, a, 'x');
+        assert.equal(r[len - 1], ref[len - 1]);
+      })),
+      b.cycle(),
+      b.complete()
+    );
+  }
+};
@@ -0,0 +1,47 @@
+const e = require('..');
+const cpus = require('os').cpus().length;
+
+// You should probably read the notes in `Performance.md`
+
+// The heap allocations of the addon per call in the steady state,
+// requires a build with `--enable_alloc_count`
+// This only reports them: the free lists do not remove all of them
+module.exports = async function (type, size, fn) {
+  // The number of allocations does not depend on the array size or the expression
+  if (size !== 1024 || fn !== 'simple') return;
+
+  const expr = e[type];
+  if (expr.allocations === undefined) {
+    console.log('rebuild with --enable_alloc_count to count the allocations');
+    return;
+  }
+
+  const allocator = global[type + 'Array'];
+  const fx = new expr('x*x + 2*x + 1', ['x']);
+  const a = new allocator(size).map((_, i) => i);
+  const target = new allocator(size);
+  const threads = Math.min(4, fx.maxParallel);
+
+  const calls = {
+    'eval()': () => fx.eval(1),
+    'map() single-threaded': () => fx.map(target, a, 'x'),
+    [`map() ${threads}-way MP`]: () => fx.map(threads, target, a, 'x'),
+    [`cwise() ${threads}-way MP`]: () => fx.cwise(threads, { x: a }, target),
+    'evalAsync()': () => fx.evalAsync(1),
+    [`mapAsync() ${threads}-way MP`]: () => fx.mapAsync(threads, target, a, 'x')
+  };
+
+  const warmup = 256;
+  const rounds = 1024;
+  const results = {};
+  for (const name of Object.keys(calls)) {
+    // eslint-disable-next-line no-await-in-loop
+    for (let i = 0; i < warmup; i++) await calls[name]();
+    const before = expr.allocations;
+    // eslint-disable-next-line no-await-in-loop
+    for (let i = 0; i < rounds; i++) await calls[name]();
+    results[name] = { 'allocations per call': (expr.allocations - before) / rounds };
+  }
+  console.log(`${type} heap allocations of the addon per call on ${cpus} threads`);
+  console.table(results);
+};
@@ -2,6 +2,7 @@
   'variables': {
     'enable_asan%': 'false',
     'enable_coverage%': 'false',
+    'enable_alloc_count%': 'false',
     'disable_int%': 'false'
   },
   'target_defaults': {
@@ -81,6 +82,7 @@
       'sources': [
         'src/expression.cc',
         'src/async.cc',
+        'src/cache.cc',
         'src/ndarray.cc'
       ],
       'include_dirs': [
@@ -102,6 +104,10 @@
         ["enable_coverage == 'true'", {
           'cflags_cc': [ '-fprofile-arcs', '-ftest-coverage' ],
           'ldflags' : [ '-lgcov', '--coverage' ]
+        }],
+        ['enable_alloc_count == "true"', {
+          'defines': [ 'EXPRTKJS_COUNT_ALLOCATIONS' ],
+          'ldflags': [ '-Wl,-Bsymbolic' ]
         }]
       ]
     },
@@ -56,6 +56,7 @@
 #include <utility>
 #include <vector>
 #include <limits>
+#include <atomic>
 
 
 namespace exprtk
@@ -2157,7 +2158,8 @@ namespace exprtk
       , max_loop_iterations(0)
       {}
 
-      details::_uint64_t max_loop_iterations;
+      // Can be lowered by another thread to stop the running loops
+      std::atomic<details::_uint64_t> max_loop_iterations;
 
       struct violation_context
       {
@@ -6592,6 +6594,19 @@ namespace exprtk
             return expression_node<T>::e_trinary;
          }
 
+         inline operator_type operation() const
+         {
+            return operation_;
+         }
+
+         inline expression_node<T>* branch(const std::size_t& index = 0) const exprtk_override
+         {
+            if (index < 3)
+               return branch_[index].first;
+            else
+               return reinterpret_cast<expression_ptr>(0);
+         }
+
          void collect_nodes(typename expression_node<T>::noderef_list_t& node_delete_list) exprtk_override
          {
             expression_node<T>::ndb_t::template collect(branch_, node_delete_list);
@@ -6686,6 +6701,17 @@ namespace exprtk
             return expression_node<T>::e_conditional;
          }
 
+         inline expression_node<T>* branch(const std::size_t& index = 0) const exprtk_override
+         {
+            switch (index)
+            {
+               case 0  : return condition_  .first;
+               case 1  : return consequent_ .first;
+               case 2  : return alternative_.first;
+               default : return reinterpret_cast<expression_ptr>(0);
+            }
+         }
+
          void collect_nodes(typename expression_node<T>::noderef_list_t& node_delete_list) exprtk_override
          {
             expression_node<T>::ndb_t::collect(condition_   , node_delete_list);
@@ -6738,6 +6764,16 @@ namespace exprtk
             return expression_node<T>::e_conditional;
          }
 
+         inline expression_node<T>* branch(const std::size_t& index = 0) const exprtk_override
+         {
+            switch (index)
+            {
+               case 0  : return condition_ .first;
+               case 1  : return consequent_.first;
+               default : return reinterpret_cast<expression_ptr>(0);
+            }
+         }
+
          void collect_nodes(typename expression_node<T>::noderef_list_t& node_delete_list) exprtk_override
          {
             expression_node<T>::ndb_t::collect(condition_  , node_delete_list);
@@ -6859,7 +6895,7 @@ namespace exprtk
          {
             if (
                  (0 == loop_runtime_check_) ||
-                 (++iteration_count_ <= max_loop_iterations_)
+                 (++iteration_count_ <= max_loop_iterations_.load(std::memory_order_relaxed))
                )
             {
                return true;
@@ -6876,7 +6912,7 @@ namespace exprtk
 
          mutable _uint64_t iteration_count_;
          mutable loop_runtime_check_ptr loop_runtime_check_;
-         const details::_uint64_t& max_loop_iterations_;
+         const std::atomic<details::_uint64_t>& max_loop_iterations_;
          loop_runtime_check::loop_types loop_type_;
       };
 
@@ -10350,6 +10386,19 @@ namespace exprtk
             return expression_node<T>::e_vararg;
          }
 
+         inline std::size_t size() const
+         {
+            return arg_list_.size();
+         }
+
+         inline expression_node<T>* branch(const std::size_t& index = 0) const exprtk_override
+         {
+            if (index < arg_list_.size())
+               return arg_list_[index].first;
+            else
+               return reinterpret_cast<expression_ptr>(0);
+         }
+
          void collect_nodes(typename expression_node<T>::noderef_list_t& node_delete_list) exprtk_override
          {
             expression_node<T>::ndb_t::collect(arg_list_, node_delete_list);
@@ -10406,6 +10455,16 @@ namespace exprtk
             return expression_node<T>::e_vararg;
          }
 
+         inline std::size_t size() const
+         {
+            return arg_list_.size();
+         }
+
+         inline const T& v(const std::size_t& index) const
+         {
+            return *arg_list_[index];
+         }
+
       private:
 
          std::vector<const T*> arg_list_;
@@ -14615,7 +14674,7 @@ namespace exprtk
             return u1_;
          }
 
-         inline ufunc_t f()
+         inline bfunc_t f()
          {
             return f_;
          }
@@ -15465,8 +15524,24 @@ namespace exprtk
          const qfunc_t f_;
       };
 
+      template <typename T, typename T0, typename T1, typename T2, typename T3>
+      class sf4ext_type_node : public T0oT1oT2oT3_base_node<T>
+      {
+      public:
+
+         virtual ~sf4ext_type_node() {}
+
+         virtual T0 t0() const = 0;
+
+         virtual T1 t1() const = 0;
+
+         virtual T2 t2() const = 0;
+
+         virtual T3 t3() const = 0;
+      };
+
       template <typename T, typename T0, typename T1, typename T2, typename T3, typename SF4Operation>
-      class T0oT1oT2oT3_sf4ext exprtk_final : public T0oT1oT2oT3_base_node<T>
+      class T0oT1oT2oT3_sf4ext exprtk_final : public sf4ext_type_node<T,T0,T1,T2,T3>
       {
       public:
 
@@ -15493,22 +15568,22 @@ namespace exprtk
             return SF4Operation::process(t0_, t1_, t2_, t3_);
          }
 
-         inline T0 t0() const
+         inline T0 t0() const exprtk_override
          {
             return t0_;
          }
 
-         inline T1 t1() const
+         inline T1 t1() const exprtk_override
          {
             return t1_;
          }
 
-         inline T2 t2() const
+         inline T2 t2() const exprtk_override
          {
             return t2_;
          }
 
-         inline T3 t3() const
+         inline T3 t3() const exprtk_override
          {
             return t3_;
          }
@@ -16404,6 +16479,11 @@ namespace exprtk
             return expression_node<T>::e_ipow;
          }
 
+         inline const T& v() const
+         {
+            return v_;
+         }
+
       private:
 
          ipow_node(const ipow_node<T,PowOp>&);
@@ -16437,6 +16517,11 @@ namespace exprtk
             return expression_node<T>::e_ipow;
          }
 
+         inline expression_node<T>* branch(const std::size_t& = 0) const exprtk_override
+         {
+            return branch_.first;
+         }
+
          void collect_nodes(typename expression_node<T>::noderef_list_t& node_delete_list) exprtk_override
          {
             expression_node<T>::ndb_t::collect(branch_, node_delete_list);
@@ -16477,6 +16562,11 @@ namespace exprtk
             return expression_node<T>::e_ipowinv;
          }
 
+         inline const T& v() const
+         {
+            return v_;
+         }
+
       private:
 
          ipowinv_node(const ipowinv_node<T,PowOp>&);
@@ -16510,6 +16600,11 @@ namespace exprtk
             return expression_node<T>::e_ipowinv;
          }
 
+         inline expression_node<T>* branch(const std::size_t& = 0) const exprtk_override
+         {
+            return branch_.first;
+         }
+
          void collect_nodes(typename expression_node<T>::noderef_list_t& node_delete_list) exprtk_override
          {
             expression_node<T>::ndb_t::template collect(branch_, node_delete_list);
@@ -19426,6 +19521,11 @@ namespace exprtk
       {
          return details::is_null_node(expr.control_block_->expr);
       }
+
+      static inline details::expression_node<T>* root(const expression<T>& expr)
+      {
+         return (expr.control_block_) ? expr.control_block_->expr : reinterpret_cast<details::expression_node<T>*>(0);
+      }
    };
 
    template <typename T>
@@ -21560,6 +21660,10 @@ namespace exprtk
             register_local_vars(expr);
             register_return_results(expr);
 
+            // Do not keep references to the symbol tables of the compiled expression,
+            // their reference counters are not thread-safe
+            symtab_store_.symtab_list_.clear();
+
             return !(!expr);
          }
          else
@@ -21582,6 +21686,8 @@ namespace exprtk
             sem_.cleanup  ();
             return_cleanup();
 
+            symtab_store_.symtab_list_.clear();
+
             return false;
          }
       }
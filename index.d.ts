@@ -7,10 +7,82 @@ export type TypedArrayConstructor = Int8ArrayConstructor | Uint8ArrayConstructor
   Uint16ArrayConstructor | Int32ArrayConstructor | Uint32ArrayConstructor |
   Float32ArrayConstructor | Float64ArrayConstructor;
 
+export interface CacheStats {
+  size: number;
+  maxSize: number;
+  hits: number;
+  misses: number;
+  evictions: number;
+}
+
+export interface ClassQueueStats {
+  count: number;
+  totalWait: number;
+  maxWait: number;
+}
+
+export type Priority = 'high' | 'normal' | 'bulk';
+
+export type QueueStats = Record<Priority, ClassQueueStats>;
+
+export interface AdmissionStats {
+  pending: number;
+  queued: number;
+  rejected: number;
+}
+
+export interface PoolStats {
+  threads: number;
+  envs: number;
+  pending: number;
+}
+
+export type Overflow = 'reject' | 'wait';
+
+export interface ParserSettings {
+  replacer: boolean;
+  joiner: boolean;
+  numericCheck: boolean;
+  bracketCheck: boolean;
+  sequenceCheck: boolean;
+  commutativeCheck: boolean;
+  strengthReduction: boolean;
+  localVariables: boolean;
+  controlStructures: boolean;
+  loops: boolean;
+  assignments: boolean;
+}
+
+export type Backend = 'tree' | 'vm' | 'block';
+export type Schedule = 'static' | 'dynamic';
+export type Threads = number | 'auto';
+
+export interface ExpressionOptions {
+  maxParallel?: number;
+  prepare?: number;
+  settings?: Partial<ParserSettings>;
+  backend?: Backend;
+  schedule?: Schedule;
+  priority?: Priority;
+  maxQueued?: number;
+  overflow?: Overflow;
+}
+
 export class Expression {
-  constructor(expression: string, scalars?: string[], vectors?: Record<string, number>);
+  constructor(expression: string, scalars?: string[], vectors?: Record<string, number>, options?: ExpressionOptions);
 
-  static readonly maxParallel: number;
+  static pipeline<E extends Expression>(
+    this: new (...args: any[]) => E, stages: (E | string)[], options?: ExpressionOptions): E;
+
+  static maxParallel: number;
+  static pinThreads: boolean;
+  static cacheSize: number;
+  static readonly cacheStats: CacheStats;
+  static readonly queueStats: QueueStats;
+  static maxQueued: number;
+  static readonly admissionStats: AdmissionStats;
+  static readonly poolStats: PoolStats;
+  static readonly allocations: number | undefined;
 
   readonly expression: string;
   static readonly type: TypedArrayType;
@@ -19,15 +91,26 @@ export class Expression {
   readonly vectors: Record<string, number>;
   maxParallel: number;
   readonly maxActive: number;
+  readonly settings: ParserSettings;
+  readonly backend: Backend;
+  schedule: Schedule;
+  priority: Priority;
+  maxQueued: number;
+  overflow: Overflow;
   static readonly allocator: TypedArrayConstructor;
   readonly allocator: TypedArrayConstructor;
+
+  prepare(instances?: number): number;
+  prepareAsync(instances?: number, signal?: AbortSignal): Promise<number>;
+  prepareAsync(callback: (this: Expression, e: Error | null, r: number | undefined) => void): void;
+  prepareAsync(instances: number, callback: (this: Expression, e: Error | null, r: number | undefined) => void): void;
 }
 
 export class TypedExpression<T extends TypedArray> extends Expression {
   eval(arguments: Record<string, number | T>): number;
   eval(...arguments: (number | T)[]): number;
 
-  evalAsync(arguments: Record<string, number | T>): Promise<number>;
+  evalAsync(arguments: Record<string, number | T>, signal?: AbortSignal): Promise<number>;
   evalAsync(...arguments: (number | T)[]): Promise<number>;
   evalAsync(arguments: Record<string, number | T>, callback: (this: TypedExpression<T>, e: Error | null, r: number | undefined) => void): void;
 
@@ -37,47 +120,61 @@ export class TypedExpression<T extends TypedArray> extends Expression {
   map(target: T, array: T, iterator: string, arguments: Record<string, number | T>): T;
   map(target: T, array: T, iterator: string, ...arguments: (number | T)[]): T;
 
-  map(threads: number, array: T, iterator: string, arguments: Record<string, number | T>): T;
-  map(threads: number, array: T, iterator: string, ...arguments: (number | T)[]): T;
-  map(threads: number, target: T, array: T, iterator: string, arguments: Record<string, number | T>): T;
-  map(threads: number, target: T, array: T, iterator: string, ...arguments: (number | T)[]): T;
+  map(threads: Threads, array: T, iterator: string, arguments: Record<string, number | T>): T;
+  map(threads: Threads, array: T, iterator: string, ...arguments: (number | T)[]): T;
+  map(threads: Threads, target: T, array: T, iterator: string, arguments: Record<string, number | T>): T;
+  map(threads: Threads, target: T, array: T, iterator: string, ...arguments: (number | T)[]): T;
 
-  mapAsync(array: T, iterator: string, arguments: Record<string, number | T>): Promise<T>;
+  map(targets: T[], array: T, iterator: string, arguments: Record<string, number | T>): T[];
+  map(targets: T[], array: T, iterator: string, ...arguments: (number | T)[]): T[];
+  map(threads: Threads, targets: T[], array: T, iterator: string, arguments: Record<string, number | T>): T[];
+  map(threads: Threads, targets: T[], array: T, iterator: string, ...arguments: (number | T)[]): T[];
+
+  mapAsync(array: T, iterator: string, arguments: Record<string, number | T>, signal?: AbortSignal): Promise<T>;
   mapAsync(array: T, iterator: string, ...arguments: (number | T)[]): Promise<T>;
   mapAsync(array: T, iterator: string, arguments: Record<string, number | T>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
 
-  mapAsync(target: T, array: T, iterator: string, arguments: Record<string, number | T>): Promise<T>;
+  mapAsync(target: T, array: T, iterator: string, arguments: Record<string, number | T>, signal?: AbortSignal): Promise<T>;
   mapAsync(target: T, array: T, iterator: string, ...arguments: (number | T)[]): Promise<T>;
   mapAsync(target: T, array: T, iterator: string, arguments: Record<string, number | T>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
 
-  mapAsync(threads: number, array: T, iterator: string, arguments: Record<string, number | T>): Promise<T>;
-  mapAsync(threads: number, array: T, iterator: string, ...arguments: (number | T)[]): Promise<T>;
-  mapAsync(threads: number, array: T, iterator: string, arguments: Record<string, number | T>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
+  mapAsync(threads: Threads, array: T, iterator: string, arguments: Record<string, number | T>, signal?: AbortSignal): Promise<T>;
+  mapAsync(threads: Threads, array: T, iterator: string, ...arguments: (number | T)[]): Promise<T>;
+  mapAsync(threads: Threads, array: T, iterator: string, arguments: Record<string, number | T>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
+
+  mapAsync(threads: Threads, target: T, array: T, iterator: string, arguments: Record<string, number | T>, signal?: AbortSignal): Promise<T>;
+  mapAsync(threads: Threads, target: T, array: T, iterator: string, ...arguments: (number | T)[]): Promise<T>;
+  mapAsync(threads: Threads, target: T, array: T, iterator: string, arguments: Record<string, number | T>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
 
-  mapAsync(threads: number, target: T, array: T, iterator: string, arguments: Record<string, number | T>): Promise<T>;
-  mapAsync(threads: number, target: T, array: T, iterator: string, ...arguments: (number | T)[]): Promise<T>;
-  mapAsync(threads: number, target: T, array: T, iterator: string, arguments: Record<string, number | T>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
+  mapAsync(targets: T[], array: T, iterator: string, arguments: Record<string, number | T>, signal?: AbortSignal): Promise<T[]>;
+  mapAsync(targets: T[], array: T, iterator: string, ...arguments: (number | T)[]): Promise<T[]>;
+  mapAsync(threads: Threads, targets: T[], array: T, iterator: string, arguments: Record<string, number | T>, signal?: AbortSignal): Promise<T[]>;
+  mapAsync(threads: Threads, targets: T[], array: T, iterator: string, ...arguments: (number | T)[]): Promise<T[]>;
 
 
   reduce(array: T, iterator: string, accumulator: string, initializer: number, arguments: Record<string, number | T>): number;
   reduce(array: T, iterator: string, accumulator: string, initializer: number, ...arguments: (number | T)[]): number;
 
-  reduceAsync(array: T, iterator: string, accumulator: string, initializer: number, arguments: Record<string, number | T>): Promise<number>;
+  reduceAsync(array: T, iterator: string, accumulator: string, initializer: number, arguments: Record<string, number | T>, signal?: AbortSignal): Promise<number>;
   reduceAsync(array: T, iterator: string, accumulator: string, initializer: number, ...arguments: (number | T)[]): Promise<number>;
   reduceAsync(array: T, iterator: string, accumulator: string, initializer: number, arguments: Record<string, number | T>, callback: (this: TypedExpression<T>, e: Error | null, r: number | undefined) => void): void
 
 
   cwise(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>): T;
   cwise<U extends TypedArray>(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, result: U): U;
-  cwise(threads: number, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>): T;
-  cwise<U extends TypedArray>(threads: number, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, result: U): U;
+  cwise(threads: Threads, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>): T;
+  cwise<U extends TypedArray>(threads: Threads, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, result: U): U;
+  cwise<U extends TypedArray[]>(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, results: [...U]): U;
+  cwise<U extends TypedArray[]>(threads: Threads, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, results: [...U]): U;
 
-  cwiseAsync(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>): Promise<T>;
-  cwiseAsync<U extends TypedArray>(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, result: U): Promise<U>;
+  cwiseAsync(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, signal?: AbortSignal): Promise<T>;
+  cwiseAsync<U extends TypedArray>(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, result: U, signal?: AbortSignal): Promise<U>;
   cwiseAsync(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
-  cwiseAsync(threads: number, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>): Promise<T>;
-  cwiseAsync<U extends TypedArray>(threads: number, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, result: U): Promise<U>;
-  cwiseAsync(threads: number, arguments: Record<string, number | TypedArray | ndarray.NdArray<T>>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
+  cwiseAsync(threads: Threads, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, signal?: AbortSignal): Promise<T>;
+  cwiseAsync<U extends TypedArray>(threads: Threads, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, result: U, signal?: AbortSignal): Promise<U>;
+  cwiseAsync(threads: Threads, arguments: Record<string, number | TypedArray | ndarray.NdArray<T>>, callback: (this: TypedExpression<T>, e: Error | null, r: T | undefined) => void): void;
+  cwiseAsync<U extends TypedArray[]>(arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, results: [...U], signal?: AbortSignal): Promise<U>;
+  cwiseAsync<U extends TypedArray[]>(threads: Threads, arguments: Record<string, number | TypedArray | ndarray.NdArray<T> | stdlib.ndarray>, results: [...U], signal?: AbortSignal): Promise<U>;
 }
 
 export class Int8 extends TypedExpression<Int8Array>{ }
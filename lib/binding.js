@@ -3,8 +3,6 @@ const binary = require('@mapbox/node-pre-gyp');
 const binding_path = binary.find(path.resolve(path.join(__dirname, '../package.json')));
 const addon = require(binding_path);
 
-const promisify = require('util').promisify;
-
 addon.Expression = class Expression {
     constructor() {
         if (this.constructor == addon.Expression)
@@ -12,6 +10,71 @@ addon.Expression = class Expression {
     }
 };
 
+/**
+ * Fuse a chain of expressions into a single `Expression` that evaluates all the stages
+ * element by element in one pass over the input, without allocating intermediate arrays.
+ *
+ * Each stage is an `Expression` followed by the name of its iterator variable which receives
+ * the result of the previous stage. The other scalar variables of all stages become the arguments
+ * of the resulting `Expression` and they are shared by name, they cannot have the name of
+ * the iterator variable of an earlier stage. The result is a normal `Expression` of the
+ * same type supporting `map()`, `cwise()`, multiple threads and the async variants.
+ *
+ * @static
+ * @param {(Expression|string)[]} stages alternating expressions and iterator variable names
+ * @param {object} [options] constructor options of the resulting `Expression`
+ * @returns {Expression}
+ * @memberof Expression
+ *
+ * @example
+ * const scale = new Float64('a * x + b', ['a', 'x', 'b']);
+ * const limit = new Float64('clamp(0, y, 1)', ['y']);
+ * const square = new Float64('z * z', ['z']);
+ *
+ * // equivalent to square.map(limit.map(scale.map(input, 'x', {a: 2, b: 1}), 'y'), 'z')
+ * const pipeline = Float64.pipeline([scale, 'x', limit, 'y', square, 'z']);
+ * const r = await pipeline.mapAsync(os.cpus().length, input, 'x', {a: 2, b: 1});
+ */
+addon.Expression.pipeline = function (stages, options) {
+    if (!Array.isArray(stages) || stages.length === 0 || stages.length % 2 !== 0)
+        throw new TypeError('stages must be an array of alternating expressions and iterator names');
+    const ctor = this === addon.Expression && stages[0] instanceof addon.Expression ? stages[0].constructor : this;
+
+    const scalars = [];
+    const intermediates = new Set();
+    let text = '';
+    let last;
+    for (let i = 0; i < stages.length; i += 2) {
+        const stage = stages[i];
+        const iterator = stages[i + 1];
+        if (!(stage instanceof addon.Expression) || stage.constructor !== ctor)
+            throw new TypeError(`stage ${i / 2} is not a ${ctor.name}`);
+        if (typeof iterator !== 'string' || !stage.scalars.includes(iterator))
+            throw new TypeError(`${iterator} is not a scalar variable of stage ${i / 2}`);
+        if (Object.keys(stage.vectors).length > 0)
+            throw new TypeError('pipeline stages cannot have vector arguments');
+        for (const s of stage.scalars) {
+            if (s !== iterator && intermediates.has(s))
+                throw new TypeError(`${s} is an intermediate result of the pipeline`);
+            // It would receive the element being iterated and not an argument
+            if (i > 0 && s !== iterator && s === stages[1])
+                throw new TypeError(`${s} is the iterator variable of the pipeline`);
+        }
+        if (i > 0) {
+            // The result of the previous stage is held in a local variable
+            if (scalars.includes(iterator))
+                throw new TypeError(`${iterator} is already an argument of the pipeline`);
+            text += `${intermediates.has(iterator) ? '' : 'var '}${iterator} := ${last};\n`;
+            intermediates.add(iterator);
+        }
+        last = `~{ ${stage.expression} }`;
+        for (const s of stage.scalars)
+            if (!intermediates.has(s) && !scalars.includes(s)) scalars.push(s);
+    }
+
+    return new ctor(text + last, scalars, undefined, options);
+};
+
 const types = [
     'Int8',
     'Uint8',
@@ -27,9 +90,48 @@ const promisifiables = [
     'evalAsync',
     'mapAsync',
     'reduceAsync',
-    'cwiseAsync'
+    'cwiseAsync',
+    'prepareAsync'
 ];
 
+// The calls of Expressions with `overflow: 'wait'` that were turned away
+// because a queue limit was reached, one queue per Expression retried in order
+// when a call of this env completes or when the addon signals that a slot
+// may have been freed in another env
+const waiting = new Map();
+const waitForRoom = addon.waitForRoom;
+delete addon.waitForRoom;
+let listening = false;
+
+const drainWaiting = function () {
+    for (const [expr, queue] of waiting) {
+        while (queue.length > 0 && queue[0]()) queue.shift();
+        if (queue.length === 0) waiting.delete(expr);
+    }
+};
+
+const listen = function () {
+    if (listening || waiting.size === 0) return;
+    listening = true;
+    waitForRoom(() => {
+        listening = false;
+        retryWaiting();
+    });
+    // A slot freed before the listener was registered would be missed
+    process.nextTick(drainWaiting);
+};
+
+const retryWaiting = function () {
+    drainWaiting();
+    listen();
+};
+
+const wait = function (expr, attempt) {
+    if (!waiting.has(expr)) waiting.set(expr, []);
+    waiting.get(expr).push(attempt);
+    listen();
+};
+
 for (const t of types) {
     if (addon[t] === undefined) {
         console.warn(`${t} type not built`);
@@ -49,14 +151,79 @@ for (const t of types) {
     });
     for (const m of promisifiables) {
         addon[t].prototype[m] = (function () {
-            const promisified = promisify(addon[t].prototype[m]);
             const original = addon[t].prototype[m];
 
-            return function () {
-                if (typeof arguments[arguments.length - 1] === 'function') {
-                    return original.apply(this, arguments);
+            // An AbortSignal cancels the native job through the function that
+            // the native method passes to the hook given after the callback,
+            // the callback is called immediately with `signal.reason`
+            const run = function (self, args, callback) {
+                const signal = args[args.length - 1] instanceof AbortSignal ? args.pop() : null;
+                if (signal && signal.aborted) {
+                    process.nextTick(() => callback.call(self, signal.reason));
+                    return;
+                }
+
+                let done = false;
+                const finish = function (e, r) {
+                    if (done) return;
+                    done = true;
+                    if (signal) signal.removeEventListener('abort', onAbort);
+                    callback.call(this, e, r);
+                };
+                const wrapped = function (e, r) {
+                    try {
+                        finish.call(this, e, r);
+                    } finally {
+                        retryWaiting();
+                    }
+                };
+                let cancel = null;
+                const call = signal ?
+                    () => original.call(self, ...args, wrapped, (fn) => {
+                        cancel = fn;
+                    }) :
+                    () => original.call(self, ...args, wrapped);
+
+                // Returns false if the call must wait for room in the queues
+                const attempt = function () {
+                    try {
+                        call();
+                    } catch (e) {
+                        if (e.code === 'EXPRTKJS_QUEUE_FULL' && self.overflow === 'wait') return false;
+                        finish.call(self, e);
+                    }
+                    return true;
+                };
+                const onAbort = () => {
+                    const queue = waiting.get(self);
+                    const idx = queue ? queue.indexOf(attempt) : -1;
+                    if (idx >= 0) queue.splice(idx, 1);
+                    if (queue && queue.length === 0) waiting.delete(self);
+                    if (cancel) cancel();
+                    finish.call(self, signal.reason);
+                };
+
+                if (self.overflow === 'wait' && waiting.has(self)) {
+                    // Do not overtake the calls of this Expression that are already waiting
+                    wait(self, attempt);
+                } else {
+                    try {
+                        call();
+                    } catch (e) {
+                        if (e.code !== 'EXPRTKJS_QUEUE_FULL' || self.overflow !== 'wait') throw e;
+                        wait(self, attempt);
+                    }
+                }
+                if (signal) signal.addEventListener('abort', onAbort, { once: true });
+            };
+
+            return function (...args) {
+                if (typeof args[args.length - 1] === 'function') {
+                    return run(this, args.slice(0, -1), args[args.length - 1]);
                 }
-                return promisified.apply(this, arguments);
+                return new Promise((resolve, reject) => {
+                    run(this, args, (e, r) => (e ? reject(e) : resolve(r)));
+                });
             };
         })();
     }
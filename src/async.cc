@@ -1,37 +1,816 @@
 #include "async.h"
 
+#include <cctype>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+
+#ifdef __linux__
+#include <dirent.h>
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 using namespace exprtk_js;
 
-std::mutex exprtk_js::global_work_mutex;
-std::queue<GenericJoblet *> exprtk_js::global_work_queue;
-std::condition_variable exprtk_js::global_condition;
+// Every worker thread has its own queue of joblets
+// A joblet enqueued by a worker thread goes to its own queue,
+// the joblets enqueued by the main thread are distributed round-robin
+// An idle worker takes from the front of its own queue and when
+// it is empty, steals from the back of the other queues
+// Each queue has one deque per priority class, all the queues are
+// searched for the highest class before moving to the next one
+struct WorkQueue {
+  std::mutex lock;
+  std::deque<GenericJoblet *> jobs[priorities];
+  // allows to skip the empty queues without locking them
+  std::atomic_size_t size;
+  // the worker of a retired queue exits after its current joblet,
+  // the joblets left in the queue are stolen by the others
+  // both are modified only while holding parkMutex
+  std::atomic_bool retired;
+  std::atomic_bool running;
+
+  WorkQueue() : lock(), jobs(), size(0), retired(false), running(false) {
+  }
+};
+
+// The pool can be resized up to `capacity` threads at runtime
+// The queues are allocated on first use and are never freed so that
+// the workers can scan the first `queuesUsed` of them without locking
+static constexpr size_t defaultCapacity = 256;
+static size_t capacity = 0;
+static std::vector<std::unique_ptr<WorkQueue>> queues;
+static std::vector<std::thread> workers;
+static std::atomic_size_t queuesUsed(0);
+static std::atomic_size_t activeWorkers(0);
+static std::mutex poolMutex;
+
+// The number of joblets in all queues and the number of parked workers
+// A worker parks only after checking `pending` under `parkMutex`,
+// and the joblets are enqueued before checking `sleeping`,
+// so that a wake-up cannot be lost
+static std::atomic_size_t pending(0);
+static std::atomic_size_t pendingClass[priorities];
+static std::atomic_size_t sleeping(0);
+static std::atomic_size_t nextQueue(0);
+static std::mutex parkMutex;
+static std::condition_variable parkCondition;
+
+static constexpr size_t noQueue = SIZE_MAX;
+static thread_local size_t currentQueue = noQueue;
+// The class of the joblet running in this worker
+static thread_local Priority currentPriority = Priority::Normal;
 
-std::vector<std::thread> workers;
+// Queue wait per class in ns
+struct ClassStats {
+  std::atomic_size_t count;
+  std::atomic_uint64_t totalWait;
+  std::atomic_uint64_t maxWait;
+};
+static ClassStats classStats[priorities];
 
-static bool theEnd = false;
+// Admission control of the asynchronous calls
+static std::atomic_size_t queueLimit(0);
+static std::atomic_size_t jobsPending(0);
+static std::atomic_size_t jobsQueued(0);
+static std::atomic_size_t jobsRejected(0);
 
+static std::atomic_bool theEnd(false);
+
+// CPU pinning, each worker checks `affinityGeneration` before taking
+// a joblet and (re)applies the current setting when it has changed
+static std::atomic_bool pinned(false);
+static std::atomic_size_t affinityGeneration(1);
+
+#ifdef __linux__
+// The CPUs allowed for this process when the pool was created,
+// ordered by NUMA node so that consecutive workers share a node
+static std::vector<int> pinCPUs;
+static cpu_set_t allowedCPUs;
+
+static int cpuNode(int cpu) {
+  // /sys/devices/system/cpu/cpuN/ contains a nodeM link on NUMA systems
+  std::string path = "/sys/devices/system/cpu/cpu" + std::to_string(cpu);
+  DIR *dir = opendir(path.c_str());
+  if (dir == nullptr) return 0;
+  int node = 0;
+  while (struct dirent *entry = readdir(dir)) {
+    if (strncmp(entry->d_name, "node", 4) == 0 && isdigit(entry->d_name[4])) {
+      node = atoi(entry->d_name + 4);
+      break;
+    }
+  }
+  closedir(dir);
+  return node;
+}
+
+static void initAffinity() {
+  CPU_ZERO(&allowedCPUs);
+  if (sched_getaffinity(0, sizeof(allowedCPUs), &allowedCPUs) != 0) return;
+  std::vector<std::pair<int, int>> cpus;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+    if (CPU_ISSET(cpu, &allowedCPUs)) cpus.push_back({cpuNode(cpu), cpu});
+  std::stable_sort(cpus.begin(), cpus.end());
+  for (auto const &cpu : cpus) pinCPUs.push_back(cpu.second);
+}
+
+static void applyAffinity(size_t self, bool pin) {
+  if (pinCPUs.empty()) return;
+  cpu_set_t set;
+  if (pin) {
+    CPU_ZERO(&set);
+    CPU_SET(pinCPUs[self % pinCPUs.size()], &set);
+  } else {
+    set = allowedCPUs;
+  }
+  pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+}
+#else
+// Thread affinity is not supported (macOS) or not implemented (Windows)
+static void initAffinity() {
+}
+static void applyAffinity(size_t, bool) {
+}
+#endif
+
+// The pool is shared by all environments - the main thread and the worker_threads -
+// that load the addon, it is started by the first one and stopped with the last one
+static size_t poolUsers = 0;
+
+// poolMutex must be held
+static void stopWorkers() {
+  {
+    std::lock_guard<std::mutex> lock(parkMutex);
+    theEnd = true;
+  }
+  parkCondition.notify_all();
+  for (auto &worker : workers)
+    if (worker.joinable()) worker.join();
+
+  // The next environment restarts it
+  std::lock_guard<std::mutex> lock(parkMutex);
+  theEnd = false;
+}
+
+// When the process exits without tearing down its environments
 void threadsDestructor() {
-  theEnd = true;
-  global_condition.notify_all();
+  std::lock_guard<std::mutex> lock(poolMutex);
+  stopWorkers();
+}
+
+static inline void pushJoblet(size_t q, GenericJoblet *j) {
+  {
+    std::lock_guard<std::mutex> lock(queues[q]->lock);
+    queues[q]->jobs[static_cast<size_t>(j->priority)].push_back(j);
+    queues[q]->size++;
+  }
+  pendingClass[static_cast<size_t>(j->priority)]++;
+  pending++;
+  if (sleeping > 0) {
+    { std::lock_guard<std::mutex> lock(parkMutex); }
+    parkCondition.notify_one();
+  }
+}
+
+void exprtk_js::scheduleJoblet(GenericJoblet *j) {
+  pushJoblet(currentQueue != noQueue ? currentQueue : nextQueue.fetch_add(1) % activeWorkers, j);
+}
+
+void exprtk_js::scheduleJoblet(GenericJoblet *j, size_t slice, size_t slices) {
+  // With pinned threads, the same slice of an array always goes to the same worker
+  // (unless stolen) and the consecutive slices go to the consecutive workers,
+  // so each slice stays on one NUMA node and is first-touched there
+  if (pinned && slices > 1 && currentQueue == noQueue) {
+    size_t workers = activeWorkers;
+    pushJoblet(slice * workers / slices, j);
+    return;
+  }
+  scheduleJoblet(j);
+}
+
+static inline bool pendingAbove(Priority priority) {
+  for (size_t c = 0; c < static_cast<size_t>(priority); c++)
+    if (pendingClass[c] > 0) return true;
+  return false;
+}
+
+// Take the next joblet of a class lower than `limit`
+static GenericJoblet *takeJoblet(size_t self, size_t limit = priorities) {
+  size_t n = queuesUsed;
+  for (size_t c = 0; c < limit; c++) {
+    if (pendingClass[c] == 0) continue;
+    for (size_t k = 0; k < n; k++) {
+      WorkQueue &q = *queues[(self + k) % n];
+      if (q.size == 0) continue;
+      std::lock_guard<std::mutex> lock(q.lock);
+      auto &jobs = q.jobs[c];
+      if (jobs.empty()) continue;
+      GenericJoblet *j;
+      if (k == 0) {
+        j = jobs.front();
+        jobs.pop_front();
+      } else {
+        j = jobs.back();
+        jobs.pop_back();
+      }
+      q.size--;
+      pendingClass[c]--;
+      pending--;
+      return j;
+    }
+  }
+  return nullptr;
+}
+
+// Run a joblet and the chain of joblets handed over to it
+// The hand-off saves a round trip through the queues but a busy Expression
+// could monopolize the thread - after `continuationBudget` consecutive
+// hand-offs, if there is other pending work, it goes first
+// A joblet of a higher class always goes first and the joblets of a class
+// at or below `limit` are not run here (see preemptionPoint)
+static constexpr size_t continuationBudget = 16;
+
+static void runJoblet(size_t self, GenericJoblet *j, size_t limit = priorities) {
+  size_t budget = continuationBudget;
+  while (j != nullptr) {
+    currentPriority = j->priority;
+    GenericJoblet *next = j->OnExecute();
+    if (next != nullptr && static_cast<size_t>(next->priority) >= limit) {
+      scheduleJoblet(next);
+      next = takeJoblet(self, limit);
+    } else if (next != nullptr && ((budget == 0 && pending > 0) || pendingAbove(next->priority))) {
+      GenericJoblet *other = takeJoblet(self);
+      if (other != nullptr) {
+        scheduleJoblet(next);
+        next = other;
+        budget = continuationBudget;
+      }
+    }
+    if (budget > 0) budget--;
+    j = next;
+  }
+}
+
+void workerThread(size_t self) {
+  currentQueue = self;
+  WorkQueue &own = *queues[self];
+  size_t affinity = 0;
+  while (true) {
+    if (affinity != affinityGeneration) {
+      affinity = affinityGeneration;
+      applyAffinity(self, pinned);
+    }
+    if (theEnd || own.retired) {
+      std::lock_guard<std::mutex> lock(parkMutex);
+      if (theEnd || own.retired) {
+        own.running = false;
+        break;
+      }
+    }
+    GenericJoblet *j = takeJoblet(self);
+    if (j != nullptr) {
+      runJoblet(self, j);
+      continue;
+    }
+    // The next joblet often comes within microseconds - from the same call
+    // or from the next one - and a worker that is still spinning needs
+    // neither the lock nor to be woken up
+    if (spinWait([&own] { return pending > 0 || theEnd || own.retired; })) continue;
+    std::unique_lock<std::mutex> lock(parkMutex);
+    sleeping++;
+    parkCondition.wait(lock, [&own] { return pending > 0 || theEnd || own.retired; });
+    sleeping--;
+  }
+  // Someone else must take over the joblets left in this queue
+  if (own.size > 0) {
+    { std::lock_guard<std::mutex> lock(parkMutex); }
+    parkCondition.notify_all();
+  }
+}
+
+// poolMutex must be held
+static void resizeWorkers(size_t threads) {
+  threads = std::max<size_t>(1, std::min(threads, capacity));
+  size_t current = activeWorkers;
+  std::vector<size_t> start;
+  {
+    std::lock_guard<std::mutex> park(parkMutex);
+    for (size_t i = threads; i < current; i++) queues[i]->retired = true;
+    for (size_t i = current; i < threads; i++) {
+      if (queues[i] == nullptr) queues[i].reset(new WorkQueue);
+      queues[i]->retired = false;
+      // A worker retired by a previous resize that is still running its
+      // last joblet simply continues, otherwise a new one is started
+      if (queues[i]->running) continue;
+      queues[i]->running = true;
+      start.push_back(i);
+    }
+    if (queuesUsed < threads) queuesUsed = threads;
+    activeWorkers = threads;
+  }
+  parkCondition.notify_all();
+
+  for (size_t i : start) {
+    if (workers[i].joinable()) workers[i].join();
+    workers[i] = std::thread(workerThread, i);
+  }
+}
+
+static void calibrateDispatch();
+
+void exprtk_js::acquireAsyncWorkers(const std::function<void(size_t &threads, bool &pin)> &configure) {
+  std::lock_guard<std::mutex> pool(poolMutex);
+  if (poolUsers > 0) {
+    poolUsers++;
+    return;
+  }
+  size_t threads = std::thread::hardware_concurrency();
+  bool pin = false;
+  configure(threads, pin);
+  poolUsers++;
+  bool first = capacity == 0;
+  if (first) {
+    std::atexit(threadsDestructor);
+    initAffinity();
+    capacity = std::max(threads, defaultCapacity);
+    queues.resize(capacity);
+    workers.resize(capacity);
+  }
+  pinned = pin;
+  {
+    // All workers of a previous pool have exited
+    std::lock_guard<std::mutex> park(parkMutex);
+    activeWorkers = 0;
+  }
+  resizeWorkers(threads);
+  // The new workers are still idle, the measurement does not block the event loop
+  if (first) std::thread(calibrateDispatch).detach();
+}
+
+void exprtk_js::releaseAsyncWorkers() {
+  std::lock_guard<std::mutex> pool(poolMutex);
+  if (--poolUsers > 0) return;
+  stopWorkers();
+}
+
+size_t exprtk_js::asyncWorkersUsers() {
+  std::lock_guard<std::mutex> pool(poolMutex);
+  return poolUsers;
+}
+
+void exprtk_js::resizeAsyncWorkers(size_t threads) {
+  std::lock_guard<std::mutex> pool(poolMutex);
+  resizeWorkers(threads);
+}
+
+size_t exprtk_js::asyncWorkers() {
+  return activeWorkers;
+}
+
+size_t exprtk_js::maxAsyncWorkers() {
+  return capacity;
+}
+
+void exprtk_js::pinAsyncWorkers(bool pin) {
+  {
+    std::lock_guard<std::mutex> lock(parkMutex);
+    pinned = pin;
+    affinityGeneration++;
+  }
+  // The parked workers apply it when they wake up
+  parkCondition.notify_all();
+}
+
+bool exprtk_js::asyncWorkersPinned() {
+  return pinned;
+}
+
+void exprtk_js::preemptionPoint() {
+  if (currentQueue == noQueue) return;
+  Priority running = currentPriority;
+  if (!pendingAbove(running)) return;
+  // The joblets of the higher classes run nested on this stack while the
+  // current one keeps its instance, they cannot be preempted themselves
+  GenericJoblet *j;
+  while ((j = takeJoblet(currentQueue, static_cast<size_t>(running))) != nullptr)
+    runJoblet(currentQueue, j, static_cast<size_t>(running));
+  currentPriority = running;
+}
+
+void exprtk_js::recordQueueWait(const GenericJoblet *j) {
+  uint64_t wait =
+    std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - j->queued).count();
+  ClassStats &stats = classStats[static_cast<size_t>(j->priority)];
+  stats.count++;
+  stats.totalWait += wait;
+  uint64_t max = stats.maxWait;
+  while (wait > max && !stats.maxWait.compare_exchange_weak(max, wait)) {}
+}
+
+QueueStats exprtk_js::queueStats(Priority priority) {
+  ClassStats &stats = classStats[static_cast<size_t>(priority)];
+  return {stats.count, stats.totalWait / 1e6, stats.maxWait / 1e6};
+}
+
+void exprtk_js::setMaxQueued(size_t max) {
+  queueLimit = max;
+  CompletionGate::notifyRoom();
+}
+
+size_t exprtk_js::maxQueued() {
+  return queueLimit;
+}
+
+bool exprtk_js::admitAsyncJob() {
+  size_t limit = queueLimit;
+  size_t pending = jobsPending;
+  do {
+    if (limit != 0 && pending >= limit) return false;
+  } while (!jobsPending.compare_exchange_weak(pending, pending + 1));
+  jobsQueued++;
+  return true;
+}
+
+void exprtk_js::releaseAsyncJob() {
+  jobsPending--;
+  // The calls waiting in the other envs cannot see it otherwise
+  CompletionGate::notifyRoom();
+}
+
+void exprtk_js::rejectAsyncJob() {
+  jobsRejected++;
+}
 
-  for (auto &worker : workers) worker.join();
+AdmissionStats exprtk_js::admissionStats() {
+  return {jobsPending, jobsQueued, jobsRejected};
 }
 
-void workerThread() {
-  while (!theEnd) {
-    GenericJoblet *j;
-    {
-      std::unique_lock<std::mutex> lock(global_work_mutex);
-      global_condition.wait(lock, [] { return !global_work_queue.empty() || theEnd; });
-      if (theEnd) return;
-      j = global_work_queue.front();
-      global_work_queue.pop();
+// An empty joblet used to measure the cost of the scheduler
+struct ProbeJoblet : public GenericJoblet {
+  std::atomic_size_t *left;
+  Semaphore *done;
+
+  virtual GenericJoblet *OnExecute() {
+    if (--*left == 0) done->unlock();
+    return nullptr;
+  }
+};
+
+// The median time to run `joblets` empty joblets from a thread outside the pool
+static double probeDispatch(size_t joblets) {
+  static constexpr size_t rounds = 9;
+  std::vector<ProbeJoblet> probes(joblets);
+  std::vector<double> samples;
+  for (size_t r = 0; r < rounds; r++) {
+    Semaphore done(true);
+    std::atomic_size_t left(joblets);
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < joblets; i++) {
+      probes[i].id = i;
+      probes[i].priority = Priority::High;
+      probes[i].left = &left;
+      probes[i].done = &done;
+      probes[i].enqueue(joblets);
     }
-    j->OnExecute();
+    done.lock();
+    samples.push_back(std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count());
   }
+  std::nth_element(samples.begin(), samples.begin() + rounds / 2, samples.end());
+  return samples[rounds / 2];
+}
+
+// A typical cost on current hardware until the calibration is done
+static std::atomic<double> dispatchRoundTrip(20000);
+static std::atomic<double> dispatchPerJoblet(2000);
+
+// Runs once in its own thread when the pool is started
+static void calibrateDispatch() {
+  size_t workers = std::max<size_t>(2, activeWorkers);
+  double one = probeDispatch(1);
+  double all = probeDispatch(workers);
+  dispatchPerJoblet = std::max(0.0, (all - one) / (workers - 1));
+  dispatchRoundTrip = one;
+}
+
+DispatchCost exprtk_js::dispatchCost() {
+  return {dispatchRoundTrip, dispatchPerJoblet};
+}
+
+static constexpr char completionResourceName[] = "ExprTk.js:completions";
+static std::mutex gatesLock;
+static std::map<napi_env, std::shared_ptr<CompletionGate>> gates;
+
+CompletionGate::CompletionGate(napi_env env)
+  : env(env),
+    tsfn(nullptr),
+    pendingJobs(0),
+    running(0),
+    cancellations(),
+    lock(),
+    drained(),
+    ready(),
+    delivering(),
+    signalled(false),
+    closed(false),
+    roomListener(),
+    roomWanted(false),
+    roomReady(false) {
+}
+
+std::shared_ptr<CompletionGate> CompletionGate::get(napi_env env) {
+  std::lock_guard<std::mutex> guard(gatesLock);
+  auto it = gates.find(env);
+  if (it != gates.end()) return it->second;
+
+  std::shared_ptr<CompletionGate> gate(new CompletionGate(env));
+  Napi::Function noop = Napi::Function::New(env, [](const Napi::CallbackInfo &) {});
+  Napi::String name = Napi::String::New(env, completionResourceName);
+  // The threadsafe function keeps the gate alive until it is finalized
+  auto *hold = new std::shared_ptr<CompletionGate>(gate);
+  napi_status status = napi_create_threadsafe_function(
+    env, noop, nullptr, name, 0, 1, hold, Finalize, gate.get(), CallJS, &gate->tsfn);
+  if (status != napi_ok) {
+    delete hold;
+    throw Napi::Error::New(env);
+  }
+  // It is referenced only while there are pending jobs
+  napi_unref_threadsafe_function(env, gate->tsfn);
+  napi_add_env_cleanup_hook(env, Cleanup, gate.get());
+  gates[env] = gate;
+  return gate;
+}
+
+void CompletionGate::retain(Cancellation *job) {
+  if (pendingJobs++ == 0 && !closed) napi_ref_threadsafe_function(env, tsfn);
+  std::lock_guard<std::mutex> guard(lock);
+  running++;
+  cancellations.push_back(job);
+}
+
+void CompletionGate::release() {
+  if (--pendingJobs == 0 && !closed && roomListener.IsEmpty()) napi_unref_threadsafe_function(env, tsfn);
+}
+
+void CompletionGate::signal() {
+  // The main thread has not yet picked up the previous ones,
+  // this one will be delivered in the same batch
+  if (signalled) return;
+  signalled = true;
+  napi_call_threadsafe_function(tsfn, nullptr, napi_tsfn_nonblocking);
+}
+
+void CompletionGate::post(Completion *c, Cancellation *job) {
+  std::lock_guard<std::mutex> guard(lock);
+  ready.push_back(c);
+  auto it = std::find(cancellations.begin(), cancellations.end(), job);
+  if (it != cancellations.end()) {
+    *it = cancellations.back();
+    cancellations.pop_back();
+  }
+  // The env is waiting for its last jobs to exit
+  if (--running == 0 && closed) drained.notify_all();
+  if (closed) return;
+  signal();
+}
+
+void CompletionGate::CallJS(napi_env env, napi_value, void *context, void *) {
+  auto *self = static_cast<CompletionGate *>(context);
+  bool room;
+  {
+    std::lock_guard<std::mutex> guard(self->lock);
+    self->ready.swap(self->delivering);
+    self->signalled = false;
+    room = self->roomReady;
+    self->roomReady = false;
+  }
+  // The threadsafe function is being torn down with the env
+  if (env == nullptr) return;
+  for (auto *c : self->delivering) {
+    c->OnComplete(env);
+    delete c;
+  }
+  self->delivering.clear();
+  if (!room || self->roomListener.IsEmpty()) return;
+  try {
+    Napi::HandleScope scope(env);
+    Napi::Function listener = self->roomListener.Value();
+    self->roomListener.Reset();
+    if (self->pendingJobs == 0 && !self->closed) napi_unref_threadsafe_function(env, self->tsfn);
+    listener.MakeCallback(Napi::Env(env).Global(), {});
+  } catch (const Napi::Error &e) {
+    fprintf(stderr, "Unhandled exception in async callback: %s\n", e.Message().c_str());
+    exit(1);
+  }
+}
+
+void CompletionGate::Finalize(napi_env, void *data, void *) {
+  delete static_cast<std::shared_ptr<CompletionGate> *>(data);
+}
+
+size_t CompletionGate::pending(napi_env env) {
+  std::lock_guard<std::mutex> guard(gatesLock);
+  auto it = gates.find(env);
+  return it != gates.end() ? it->second->pendingJobs : 0;
+}
+
+// The number of envs waiting for room, the others are not notified
+static std::atomic_size_t roomWaiters(0);
+
+void CompletionGate::waitForRoom(napi_env env, Napi::Function listener) {
+  auto gate = get(env);
+  if (gate->closed) return;
+  // The event loop is kept alive until the notification
+  if (gate->roomListener.IsEmpty()) napi_ref_threadsafe_function(env, gate->tsfn);
+  gate->roomListener = Napi::Persistent(listener);
+  if (!gate->roomWanted.exchange(true)) roomWaiters++;
+}
+
+void CompletionGate::notifyRoom() {
+  if (roomWaiters == 0) return;
+  std::lock_guard<std::mutex> guard(gatesLock);
+  for (auto const &g : gates) {
+    CompletionGate *gate = g.second.get();
+    if (!gate->roomWanted.exchange(false)) continue;
+    roomWaiters--;
+    std::lock_guard<std::mutex> lock(gate->lock);
+    if (gate->closed) continue;
+    gate->roomReady = true;
+    gate->signal();
+  }
+}
+
+void CompletionGate::Cleanup(void *arg) {
+  auto *self = static_cast<CompletionGate *>(arg);
+  if (self->roomWanted.exchange(false)) roomWaiters--;
+  self->roomListener.Reset();
+  std::vector<Completion *> abandoned;
+  {
+    // The joblets of this env may still be running in the shared pool,
+    // the Expressions that they use will be destroyed with the env
+    // They are cancelled: the running loops are interrupted and
+    // the queued joblets are dropped without being evaluated
+    std::unique_lock<std::mutex> guard(self->lock);
+    self->closed = true;
+    for (auto *c : self->cancellations) c->cancel();
+    self->drained.wait(guard, [self] { return self->running == 0; });
+    abandoned.swap(self->ready);
+  }
+  for (auto *c : abandoned) {
+    c->OnAbandon();
+    delete c;
+  }
+  napi_release_threadsafe_function(self->tsfn, napi_tsfn_abort);
+  std::lock_guard<std::mutex> guard(gatesLock);
+  gates.erase(self->env);
+}
+
+thread_local Cancellation *exprtk_js::currentCancellation = nullptr;
+
+void Cancellation::cancel() {
+  std::lock_guard<std::mutex> guard(lock);
+  aborted = true;
+  for (auto *i : running) i->interrupt();
+}
+
+void Cancellation::enter(Interruptible *i) {
+  std::lock_guard<std::mutex> guard(lock);
+  running.push_back(i);
+  if (aborted) i->interrupt();
+}
+
+void Cancellation::leave(Interruptible *i) {
+  std::lock_guard<std::mutex> guard(lock);
+  running.erase(std::find(running.begin(), running.end(), i));
+  // Nobody else can interrupt it after this point
+  i->resume();
+}
+
+#ifdef EXPRTKJS_COUNT_ALLOCATIONS
+// Test builds (--enable_alloc_count) count the heap allocations of the addon
+// The replaced operators are exported like those of the C++ runtime, on Linux
+// the addon is linked with -Bsymbolic so that its own calls are bound to
+// them, the calls of Node.js are still bound to its own allocator
+static std::atomic_size_t allocations(0);
+
+static inline void *countedAlloc(size_t size) noexcept {
+  allocations++;
+  return std::malloc(size > 0 ? size : 1);
+}
+
+static inline void *countedAlloc(size_t size, std::align_val_t align) noexcept {
+  allocations++;
+  if (size == 0) size = 1;
+#ifdef _WIN32
+  return _aligned_malloc(size, static_cast<size_t>(align));
+#else
+  void *p;
+  if (posix_memalign(&p, std::max(sizeof(void *), static_cast<size_t>(align)), size) != 0) return nullptr;
+  return p;
+#endif
+}
+
+static inline void countedFree(void *p, std::align_val_t) noexcept {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+void *operator new(size_t size) {
+  void *p = countedAlloc(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size) {
+  void *p = countedAlloc(size);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+  return countedAlloc(size);
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+  return countedAlloc(size);
+}
+
+void *operator new(size_t size, std::align_val_t align) {
+  void *p = countedAlloc(size, align);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new[](size_t size, std::align_val_t align) {
+  void *p = countedAlloc(size, align);
+  if (p == nullptr) throw std::bad_alloc();
+  return p;
+}
+
+void *operator new(size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+  return countedAlloc(size, align);
+}
+
+void *operator new[](size_t size, std::align_val_t align, const std::nothrow_t &) noexcept {
+  return countedAlloc(size, align);
+}
+
+void operator delete(void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+void operator delete[](void *p, const std::nothrow_t &) noexcept {
+  std::free(p);
+}
+
+void operator delete(void *p, std::align_val_t align) noexcept {
+  countedFree(p, align);
+}
+
+void operator delete[](void *p, std::align_val_t align) noexcept {
+  countedFree(p, align);
+}
+
+void operator delete(void *p, size_t, std::align_val_t align) noexcept {
+  countedFree(p, align);
+}
+
+void operator delete[](void *p, size_t, std::align_val_t align) noexcept {
+  countedFree(p, align);
+}
+
+void operator delete(void *p, std::align_val_t align, const std::nothrow_t &) noexcept {
+  countedFree(p, align);
+}
+
+void operator delete[](void *p, std::align_val_t align, const std::nothrow_t &) noexcept {
+  countedFree(p, align);
 }
 
-void exprtk_js::initAsyncWorkers(size_t threads) {
-  std::atexit(threadsDestructor);
-  for (size_t i = 0; i < threads; i++) workers.push_back(std::thread(workerThread));
+size_t exprtk_js::heapAllocations() {
+  return allocations;
 }
+#endif
@@ -1,12 +1,16 @@
 #pragma once
 
+#include <algorithm>
+#include <chrono>
 #include <functional>
 #include <map>
+#include <memory>
 #include <thread>
 #include <mutex>
 #include <queue>
 #include <condition_variable>
 #include <atomic>
+#include <vector>
 
 #include <napi.h>
 
@@ -39,18 +43,159 @@ static constexpr char asyncResourceName[] = "ExprTk.js:async";
 template <class T> class Expression;
 template <class T> struct ExpressionInstance;
 template <class T> class InstanceGuard;
+template <class T> class AdmissionGuard;
 struct GenericJoblet;
 
 class GenericWorker {
     public:
-  virtual void OnExecute(GenericJoblet *j) = 0;
+  virtual GenericJoblet *OnExecute(GenericJoblet *j) = 0;
   virtual ~GenericWorker() = default;
 };
 
 template <class T> class AsyncWorker;
-extern std::mutex global_work_mutex;
-extern std::condition_variable global_condition;
-extern std::queue<GenericJoblet *> global_work_queue;
+
+// An asynchronous job whose result is delivered to JS by the CompletionGate of its env
+class Completion {
+    public:
+  // Called in the main thread, the Completion is deleted after this
+  virtual void OnComplete(napi_env env) = 0;
+  // Called instead when the env is torn down before the delivery
+  virtual void OnAbandon() = 0;
+  virtual ~Completion() = default;
+};
+
+// All the completions of one env go through a single long-lived threadsafe function,
+// those that are posted before the main thread gets to them are delivered in one batch
+class Cancellation;
+class CompletionGate {
+    public:
+  // The gate of this env, created on first use, main thread only
+  static std::shared_ptr<CompletionGate> get(napi_env env);
+  // The gate keeps the event loop alive while there are pending jobs, main thread only
+  // The Cancellation of the job is triggered if the env is torn down before it finishes
+  void retain(Cancellation *job);
+  void release();
+  // Called by the worker thread that finished the job
+  void post(Completion *c, Cancellation *job);
+  // The calls of this env that have not been delivered yet
+  static size_t pending(napi_env env);
+  // Call `listener` once in the main thread of this env, the next time a slot
+  // of the asynchronous queues may have been freed in any env, main thread only
+  static void waitForRoom(napi_env env, Napi::Function listener);
+  // Called by anyone who frees a slot or raises a limit
+  static void notifyRoom();
+
+    private:
+  explicit CompletionGate(napi_env env);
+  static void CallJS(napi_env env, napi_value js_callback, void *context, void *data);
+  static void Finalize(napi_env env, void *data, void *hint);
+  static void Cleanup(void *arg);
+  // Must be called with the lock held
+  void signal();
+
+  napi_env env;
+  napi_threadsafe_function tsfn;
+  size_t pendingJobs;
+  // The jobs that have not finished running, the env
+  // cannot be torn down while they use its Expressions
+  size_t running;
+  // The cancellations of these jobs
+  std::vector<Cancellation *> cancellations;
+  std::mutex lock;
+  std::condition_variable drained;
+  // Filled by the worker threads, swapped with the second one which is
+  // emptied by the main thread, so that both keep their capacity
+  std::vector<Completion *> ready;
+  std::vector<Completion *> delivering;
+  bool signalled;
+  bool closed;
+  // The JS wrapper has calls waiting for room, main thread only
+  Napi::FunctionReference roomListener;
+  // Cleared by the first notification
+  std::atomic_bool roomWanted;
+  // A notification is to be delivered with the next batch
+  bool roomReady;
+};
+
+// The scheduler always runs the joblets of the highest class first
+// and bulk joblets yield to the others between chunks
+enum class Priority : uint8_t { High, Normal, Bulk };
+static constexpr size_t priorities = 3;
+
+// Something that a Cancellation can interrupt while it is running
+class Interruptible {
+    public:
+  virtual void interrupt() = 0;
+  virtual void resume() = 0;
+  virtual ~Interruptible() = default;
+};
+
+static constexpr char abortedError[] = "evaluation aborted";
+// The code of the Error of the calls turned away by the admission control
+static constexpr char queueFullCode[] = "EXPRTKJS_QUEUE_FULL";
+
+// The cancellation of an asynchronous job, shared by its joblets
+// and by the JS function that triggers it
+// It is checked before running each joblet and between the chunks,
+// the running ExprTk loops are interrupted
+class Cancellation {
+    public:
+  Cancellation() : aborted(false), lock(), running() {
+  }
+
+  inline bool cancelled() const {
+    return aborted;
+  }
+  void cancel();
+  void enter(Interruptible *i);
+  void leave(Interruptible *i);
+
+    private:
+  std::atomic_bool aborted;
+  std::mutex lock;
+  std::vector<Interruptible *> running;
+};
+
+// The cancellation of the joblet running in this thread, if any
+extern thread_local Cancellation *currentCancellation;
+
+// Time spent by the joblets of a class between the start of
+// the call and the start of their execution
+struct QueueStats {
+  size_t count;
+  double totalWait;
+  double maxWait;
+};
+
+// The cost of a round trip through the worker threads in ns,
+// measured once in the background when the pool is started,
+// a fixed estimate is returned until then
+struct DispatchCost {
+  // Scheduling one joblet and waiting for it in the main thread
+  double roundTrip;
+  // Each additional joblet of the same job
+  double perJoblet;
+};
+
+// The asynchronous calls that are currently queued or running,
+// the ones that were accepted and the ones that were turned away
+// because a queue limit was reached
+struct AdmissionStats {
+  size_t pending;
+  size_t queued;
+  size_t rejected;
+};
+
+// Push a joblet on the queue of the current worker thread,
+// or on the next one if called from the main thread
+void scheduleJoblet(GenericJoblet *j);
+// Same for one of the `slices` joblets of a multithreaded job,
+// when the threads are pinned, the slice determines the worker
+void scheduleJoblet(GenericJoblet *j, size_t slice, size_t slices);
+// Called by a running joblet between two chunks of work,
+// a bulk joblet runs here the pending joblets of the higher classes
+void preemptionPoint();
+void recordQueueWait(const GenericJoblet *j);
 
 /**
  * A Joblet is a single thread splinter of a Job
@@ -58,21 +203,87 @@ extern std::queue<GenericJoblet *> global_work_queue;
 struct GenericJoblet {
   GenericWorker *worker;
   size_t id;
+  Priority priority = Priority::Normal;
+  std::chrono::steady_clock::time_point queued;
   inline void enqueue() {
-    std::unique_lock<std::mutex> globalLock(global_work_mutex);
-    global_work_queue.push(this);
-    globalLock.unlock();
-    global_condition.notify_one();
+    scheduleJoblet(this);
   }
-  virtual void OnExecute() = 0;
+  inline void enqueue(size_t slices) {
+    scheduleJoblet(this, id, slices);
+  }
+  // Returns the next joblet that can continue in the same thread or nullptr
+  virtual GenericJoblet *OnExecute() = 0;
   virtual ~GenericJoblet() = default;
 };
 
+// Per-thread free lists of the memory of the finished calls
+// The Workers are created and destroyed in the main thread of their env
+// so recycling their memory there does not need any locking
+static constexpr size_t maxSpares = 64;
+
+// Cleared containers that keep their capacity
+template <typename V> class Spares {
+    public:
+  static inline V take() {
+    auto &spares = list();
+    if (spares.empty()) return V();
+    V v = std::move(spares.back());
+    spares.pop_back();
+    return v;
+  }
+
+  static inline void give(V &&v) {
+    auto &spares = list();
+    if (spares.size() >= maxSpares) return;
+    v.clear();
+    spares.push_back(std::move(v));
+  }
+
+    private:
+  static inline std::vector<V> &list() {
+    static thread_local std::vector<V> spares;
+    return spares;
+  }
+};
+
+// Raw blocks of one size, for class-specific operator new/delete
+template <size_t size> class SpareBlocks {
+    public:
+  static inline void *take() {
+    auto &spares = list().blocks;
+    if (spares.empty()) return ::operator new(size);
+    void *p = spares.back();
+    spares.pop_back();
+    return p;
+  }
+
+  static inline void give(void *p) {
+    auto &spares = list().blocks;
+    if (spares.size() >= maxSpares) {
+      ::operator delete(p);
+      return;
+    }
+    spares.push_back(p);
+  }
+
+    private:
+  struct Blocks {
+    std::vector<void *> blocks;
+    ~Blocks() {
+      for (void *p : blocks) ::operator delete(p);
+    }
+  };
+  static inline Blocks &list() {
+    static thread_local Blocks spares;
+    return spares;
+  }
+};
+
 template <class T> struct Joblet : public GenericJoblet {
   ExpressionInstance<T> *instance;
 
-  virtual void OnExecute() {
-    worker->OnExecute(this);
+  virtual GenericJoblet *OnExecute() {
+    return worker->OnExecute(this);
   }
 };
 
@@ -82,16 +293,30 @@ template <class T> class Worker : public GenericWorker {
   typedef std::function<T(const ExpressionInstance<T> &, size_t)> MainFunc;
   typedef std::function<Napi::Value(const T)> RValFunc;
 
-  explicit Worker(Expression<T> *e, const MainFunc &doit, const RValFunc &rval, size_t joblets);
-  virtual ~Worker() = default;
+  explicit Worker(
+    Expression<T> *e,
+    MainFunc &&doit,
+    RValFunc &&rval,
+    size_t joblets,
+    const std::vector<ExpressionInstance<T> *> &instances);
+  virtual ~Worker();
 
-  virtual void OnExecute(GenericJoblet *j);
+  virtual GenericJoblet *OnExecute(GenericJoblet *j);
   virtual void OnFinish() = 0;
-  void Queue();
+  void Queue(size_t first = 0);
+  // Queue all joblets but the first one which is run in the calling thread
+  void QueueAndRun();
+
+  inline const std::shared_ptr<Cancellation> &GetCancellation() const {
+    return cancellation;
+  }
 
   inline T Result() {
     return raw;
   }
+  inline Napi::Value Value() {
+    return rval(raw);
+  }
   inline const char *Error() {
     return err;
   }
@@ -100,6 +325,7 @@ template <class T> class Worker : public GenericWorker {
   Expression<T> *expression;
   const MainFunc doit;
   const RValFunc rval;
+  std::shared_ptr<Cancellation> cancellation;
 
     private:
   T raw;
@@ -109,35 +335,63 @@ template <class T> class Worker : public GenericWorker {
 };
 
 template <class T>
-Worker<T>::Worker(Expression<T> *e, const MainFunc &doit, const RValFunc &rval, size_t nJoblets)
+Worker<T>::Worker(
+  Expression<T> *e,
+  MainFunc &&doit,
+  RValFunc &&rval,
+  size_t nJoblets,
+  const std::vector<ExpressionInstance<T> *> &instances)
+
+  : expression(e),
+    doit(std::move(doit)),
+    rval(std::move(rval)),
+    cancellation(),
+    err(nullptr),
+    joblets(Spares<std::vector<Joblet<T>>>::take()),
+    jobletsReady(0) {
 
-  : expression(e), doit(doit), rval(rval), err(nullptr), joblets(nJoblets), jobletsReady(0) {
+  joblets.resize(nJoblets);
 
   for (size_t i = 0; i < nJoblets; i++) {
     joblets[i].worker = this;
     joblets[i].id = i;
-    joblets[i].instance = nullptr;
+    joblets[i].priority = e->jobPriority();
+    // Joblets can be assigned an instance in advance
+    joblets[i].instance = i < instances.size() ? instances[i] : nullptr;
   }
 }
 
-template <class T> void Worker<T>::OnExecute(GenericJoblet *j) {
+template <class T> Worker<T>::~Worker() {
+  Spares<std::vector<Joblet<T>>>::give(std::move(joblets));
+}
+
+template <class T> GenericJoblet *Worker<T>::OnExecute(GenericJoblet *j) {
   auto *joblet = reinterpret_cast<Joblet<T> *>(j);
+  recordQueueWait(joblet);
   // Here we are in the aux thread, JS is running
-  try {
-    raw = doit(*joblet->instance, joblet->id);
-  } catch (const char *err) { this->err = err; }
+  if (cancellation != nullptr && cancellation->cancelled()) {
+    // The remaining joblets of a cancelled job only release their instances
+    err = abortedError;
+  } else {
+    // Instances are compiled on first use, here, outside of the main thread
+    if (!joblet->instance->isInit) expression->compileInstance(joblet->instance);
+    Cancellation *outer = currentCancellation;
+    currentCancellation = cancellation.get();
+    if (cancellation != nullptr) cancellation->enter(joblet->instance->loopInterrupt.get());
+    try {
+      raw = doit(*joblet->instance, joblet->id);
+    } catch (const char *err) { this->err = err; }
+    if (cancellation != nullptr) cancellation->leave(joblet->instance->loopInterrupt.get());
+    currentCancellation = outer;
+  }
 
   auto *w = expression->dequeue();
   if (w != nullptr) {
-    w->instance = joblet->instance;
-    // TODO this requires one iteration of the worker thread
-    // which can be avoided -> we can immediately run the next job
-    // but in this case the scheduling won't be fair unless
-    // some other mechanism is implemented
-
     // This is what is not possible with the default Node.js async mechanism:
-    // enqueue a new job in the aux thread
-    w->enqueue();
+    // the instance is handed over to the next waiting joblet which continues
+    // in this thread without going through the queues (the scheduler
+    // can still queue it to be fair to the other Expressions)
+    w->instance = joblet->instance;
   } else {
     expression->releaseIdleInstance(joblet->instance);
   }
@@ -150,16 +404,28 @@ template <class T> void Worker<T>::OnExecute(GenericJoblet *j) {
   // From now on `this` can potentially be already deleted
   // (OnFinish() will delete it)
   if (ready + 1 == size) OnFinish();
+  return w;
 }
 
-template <class T> void Worker<T>::Queue() {
-  for (auto &j : joblets) {
+template <class T> void Worker<T>::Queue(size_t first) {
+  // Once the last joblet is enqueued, `this` can be deleted at any moment
+  size_t size = joblets.size();
+  Joblet<T> *jobs = joblets.data();
+  auto now = std::chrono::steady_clock::now();
+  for (size_t n = first; n < size; n++) {
+    Joblet<T> &j = jobs[n];
+    j.queued = now;
+    if (j.instance != nullptr) {
+      // This joblet has been assigned an instance in advance
+      j.enqueue(size);
+      continue;
+    }
     ExpressionInstance<T> *i = expression->getIdleInstance();
     if (i != nullptr) {
       // There is an idle instance in this Expression
       // -> enqueue on the master queue for immediate execution
       j.instance = i;
-      j.enqueue();
+      j.enqueue(size);
       continue;
     }
     // There is no idle instance in this Expression
@@ -169,10 +435,27 @@ template <class T> void Worker<T>::Queue() {
   }
 }
 
+template <class T> void Worker<T>::QueueAndRun() {
+  // The calling thread must not wait for an instance before
+  // the other joblets have been queued
+  Joblet<T> &own = joblets[0];
+  if (own.instance == nullptr) own.instance = expression->getIdleInstance();
+  if (own.instance == nullptr) {
+    Queue();
+    return;
+  }
+  own.queued = std::chrono::steady_clock::now();
+  Queue(1);
+  GenericJoblet *next = OnExecute(&own);
+  // An evaluation waiting for the instance that was just released
+  // goes to the worker threads, the calling thread has its own job to finish
+  if (next != nullptr) scheduleJoblet(next);
+}
+
 // This a Worker that handles running a job in multiple threads,
 // handles persistence, and calls a JS callback
 // This worker deletes itself on completion
-template <class T> class AsyncWorker : public Worker<T> {
+template <class T> class AsyncWorker : public Worker<T>, public Completion {
     public:
   using typename Worker<T>::MainFunc;
   using typename Worker<T>::RValFunc;
@@ -180,62 +463,89 @@ template <class T> class AsyncWorker : public Worker<T> {
   explicit AsyncWorker(
     Expression<T> *e,
     Napi::Function &callback,
-    const MainFunc &doit,
-    const RValFunc &rval,
+    MainFunc &&doit,
+    RValFunc &&rval,
     size_t joblets,
-    const std::map<std::string, Napi::Object> &objects);
+    const std::vector<ExpressionInstance<T> *> &instances,
+    const std::vector<Napi::Object> &objects);
   virtual ~AsyncWorker();
 
+  static inline void *operator new(size_t) {
+    return SpareBlocks<sizeof(AsyncWorker<T>)>::take();
+  }
+  static inline void operator delete(void *p) {
+    SpareBlocks<sizeof(AsyncWorker<T>)>::give(p);
+  }
+
   virtual void OnFinish();
+  virtual void OnComplete(napi_env env);
+  virtual void OnAbandon();
 
     private:
-  static void CallJS(napi_env env, napi_value js_callback, void *context, void *data);
-  std::map<std::string, Napi::ObjectReference> persistent;
+  std::vector<Napi::ObjectReference> persistent;
   Napi::Env env;
   Napi::Reference<Napi::Function> callbackRef;
-  napi_threadsafe_function callbackGate;
-  Napi::Object asyncResource;
+  std::shared_ptr<CompletionGate> gate;
+  napi_async_context context;
 };
 
 template <class T>
 AsyncWorker<T>::AsyncWorker(
   Expression<T> *e,
   Napi::Function &callback,
-  const MainFunc &doit,
-  const RValFunc &rval,
+  MainFunc &&doit,
+  RValFunc &&rval,
   size_t nJoblets,
-  const std::map<std::string, Napi::Object> &objects)
+  const std::vector<ExpressionInstance<T> *> &instances,
+  const std::vector<Napi::Object> &objects)
 
-  : Worker<T>(e, doit, rval, nJoblets), env(callback.Env()), callbackRef(Napi::Persistent(callback)) {
+  : Worker<T>(e, std::move(doit), std::move(rval), nJoblets, instances),
+    persistent(Spares<std::vector<Napi::ObjectReference>>::take()),
+    env(callback.Env()),
+    callbackRef(Napi::Persistent(callback)),
+    gate(CompletionGate::get(env)),
+    context(nullptr) {
 
+  // Every call still gets its own async context, only the threadsafe function is shared
   Napi::String asyncResourceNameObject = Napi::String::New(env, asyncResourceName);
-  napi_status status = napi_create_threadsafe_function(
-    env, callback, nullptr, asyncResourceNameObject, 0, 1, nullptr, nullptr, this, CallJS, &callbackGate);
+  napi_status status = napi_async_init(env, nullptr, asyncResourceNameObject, &context);
   if ((status) != napi_ok) throw Napi::Error::New(env);
+  // Every asynchronous job can be cancelled, by JS or by the teardown of the env
+  this->cancellation = std::make_shared<Cancellation>();
+  gate->retain(this->cancellation.get());
 
-  for (auto const &i : objects) persistent[i.first] = Napi::Persistent(i.second);
+  for (auto const &i : objects) persistent.push_back(Napi::Persistent(i));
 }
 
 template <class T> AsyncWorker<T>::~AsyncWorker() {
-  napi_release_threadsafe_function(callbackGate, napi_tsfn_release);
+  napi_async_destroy(env, context);
+  gate->release();
+  Spares<std::vector<Napi::ObjectReference>>::give(std::move(persistent));
 }
 
 template <class T> void AsyncWorker<T>::OnFinish() {
-  // This will trigger CallJS in the main thread
-  napi_call_threadsafe_function(callbackGate, nullptr, napi_tsfn_blocking);
+  // This will trigger OnComplete in the main thread
+  gate->post(this, this->cancellation.get());
 }
 
-template <class T> void AsyncWorker<T>::CallJS(napi_env env, napi_value js_callback, void *context, void *data) {
+template <class T> void AsyncWorker<T>::OnAbandon() {
+  // There is no one left to call back
+  this->expression->releaseJob();
+}
+
+template <class T> void AsyncWorker<T>::OnComplete(napi_env env) {
   // Here we are back in the main V8 thread, JS is not running
-  auto *self = static_cast<AsyncWorker<T> *>(context);
+  // The callback can already start a new call in the freed slot
+  this->expression->releaseJob();
   try {
     // If the JS callback throws, MakeCallback will throw a JS Error object as a C++ exception
     // Normally node-addon-api handles these, but not in this case
-    auto cb = Napi::Function(env, js_callback);
-    if (self->Error() == nullptr) {
-      cb.MakeCallback(self->expression->Value(), {Napi::Env(env).Null(), self->rval(self->Result())}, nullptr);
+    Napi::HandleScope scope(env);
+    auto cb = callbackRef.Value();
+    if (this->Error() == nullptr) {
+      cb.MakeCallback(this->expression->Value(), {Napi::Env(env).Null(), this->rval(this->Result())}, context);
     } else {
-      cb.MakeCallback(self->expression->Value(), {Napi::Error::New(env, self->Error()).Value()}, nullptr);
+      cb.MakeCallback(this->expression->Value(), {Napi::Error::New(env, this->Error()).Value()}, context);
     }
   } catch (const Napi::Error &e) {
     // Alas, there is currently no way to properly terminate the Node process
@@ -243,7 +553,6 @@ template <class T> void AsyncWorker<T>::CallJS(napi_env env, napi_value js_callb
     fprintf(stderr, "Unhandled exception in async callback: %s\n", e.Message().c_str());
     exit(1);
   }
-  delete self;
 }
 
 // This a Worker that handles running a job in multiple threads
@@ -254,7 +563,13 @@ template <class T> class SyncWorker : public Worker<T> {
   using typename Worker<T>::MainFunc;
   using typename Worker<T>::RValFunc;
 
-  explicit SyncWorker(Expression<T> *e, Semaphore &sem, const MainFunc &doit, const RValFunc &rval, size_t joblets);
+  explicit SyncWorker(
+    Expression<T> *e,
+    Semaphore &sem,
+    MainFunc &&doit,
+    RValFunc &&rval,
+    size_t joblets,
+    const std::vector<ExpressionInstance<T> *> &instances);
   virtual ~SyncWorker() = default;
 
   virtual void OnFinish();
@@ -264,14 +579,157 @@ template <class T> class SyncWorker : public Worker<T> {
 };
 
 template <class T>
-SyncWorker<T>::SyncWorker(Expression<T> *e, Semaphore &sem, const MainFunc &doit, const RValFunc &rval, size_t nJoblets)
-  : Worker<T>(e, doit, rval, nJoblets), sem(sem) {
+SyncWorker<T>::SyncWorker(
+  Expression<T> *e,
+  Semaphore &sem,
+  MainFunc &&doit,
+  RValFunc &&rval,
+  size_t nJoblets,
+  const std::vector<ExpressionInstance<T> *> &instances)
+  : Worker<T>(e, std::move(doit), std::move(rval), nJoblets, instances), sem(sem) {
 }
 
 template <class T> void SyncWorker<T>::OnFinish() {
   sem.unlock();
 }
 
+// How map() and cwise() split the elements among the joblets
+enum class Schedule : uint8_t { Static, Dynamic };
+
+// What happens to an asynchronous call when a queue limit is reached,
+// the waiting calls are held by the JS wrapper until there is room
+enum class Overflow : uint8_t { Reject, Wait };
+
+// The measured time to evaluate one element in ns, 0 until measured
+// An exponential moving average of the ranges of all joblets
+class ElementCost {
+    public:
+  // Smaller ranges are dominated by the cost of setting up the evaluation
+  static constexpr size_t minElements = 64;
+
+  ElementCost() : cost(0) {
+  }
+
+  inline double get() const {
+    return cost.load(std::memory_order_relaxed);
+  }
+
+  // Called concurrently by the joblets
+  inline void record(double elapsed, size_t elements) {
+    if (elements < minElements) return;
+    const double sample = elapsed / elements;
+    double current = cost.load(std::memory_order_relaxed);
+    double next;
+    do {
+      next = current == 0 ? sample : current + (sample - current) / 4;
+    } while (!cost.compare_exchange_weak(current, next, std::memory_order_relaxed));
+  }
+
+    private:
+  std::atomic<double> cost;
+};
+
+// Static gives each joblet one contiguous slice of equal size,
+// Dynamic lets the joblets claim fixed-size chunks from a shared cursor
+// until there are none left so that the fast joblets take over
+// the work of the slow ones when the cost per element varies
+class Partition {
+    public:
+  // At least 8 chunks per joblet on the small arrays
+  static constexpr size_t maxChunkSize = 4096;
+  static constexpr size_t chunksPerJoblet = 8;
+
+  Partition(
+    Schedule schedule, size_t len, size_t joblets, Priority priority = Priority::Normal, ElementCost *meter = nullptr)
+    : schedule(schedule),
+      len(len),
+      // integer division ceiling
+      lenPerJoblet((len + joblets - 1) / joblets),
+      chunkSize(std::max<size_t>(1, std::min(maxChunkSize, lenPerJoblet / chunksPerJoblet))),
+      preemptible(priority == Priority::Bulk),
+      meter(meter),
+      cursor(schedule == Schedule::Dynamic ? new std::atomic_size_t(0) : nullptr) {
+  }
+
+  // The ranges claimed by one joblet
+  class Range {
+      public:
+    Range(const Partition &p, size_t id)
+      : partition(p),
+        cancellation(currentCancellation),
+        // Preemptible and cancellable slices are processed in chunks
+        chunked(p.preemptible || cancellation != nullptr),
+        claimed(false),
+        sliceEnd(std::min(p.len, (id + 1) * p.lenPerJoblet)),
+        position(std::min(p.len, id * p.lenPerJoblet)),
+        elements(0),
+        started() {
+    }
+
+    // Get the next range [start, end), false when there is no more work
+    inline bool next(size_t &start, size_t &end) {
+      // The previous range is timed before the nested joblets of preemptionPoint()
+      if (claimed && partition.meter != nullptr) {
+        partition.meter->record(
+          std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - started).count(), elements);
+        elements = 0;
+      }
+      if (claimed && partition.preemptible) preemptionPoint();
+      if (claimed && cancellation != nullptr && cancellation->cancelled()) throw abortedError;
+      if (partition.schedule == Schedule::Static) {
+        if (position >= sliceEnd || (claimed && !chunked)) return false;
+        claimed = true;
+        start = position;
+        end = chunked ? std::min(sliceEnd, start + maxChunkSize) : sliceEnd;
+        position = end;
+      } else {
+        claimed = true;
+        start = partition.cursor->fetch_add(partition.chunkSize);
+        if (start >= partition.len) return false;
+        end = std::min(partition.len, start + partition.chunkSize);
+      }
+      elements = end - start;
+      if (partition.meter != nullptr) started = std::chrono::steady_clock::now();
+      return true;
+    }
+
+      private:
+    const Partition &partition;
+    const Cancellation *cancellation;
+    bool chunked;
+    bool claimed;
+    size_t sliceEnd;
+    size_t position;
+    // The range being evaluated
+    size_t elements;
+    std::chrono::steady_clock::time_point started;
+  };
+
+  inline Range range(size_t id) const {
+    return Range(*this, id);
+  }
+
+    private:
+  Schedule schedule;
+  size_t len;
+  size_t lenPerJoblet;
+  size_t chunkSize;
+  bool preemptible;
+  // Receives the time spent on each range
+  ElementCost *meter;
+  // shared by the copies captured by all joblets of the same job
+  std::shared_ptr<std::atomic_size_t> cursor;
+};
+
+// The asynchronous methods take the callback as their last argument,
+// the JS wrapper of an abortable call passes after it a second function
+// which receives the function that cancels the job
+inline size_t callbackArg(const Napi::CallbackInfo &info) {
+  size_t n = info.Length();
+  if (n >= 2 && info[n - 1].IsFunction() && info[n - 2].IsFunction()) return n - 2;
+  return n - 1;
+}
+
 template <class T> class Job {
     public:
   typedef std::function<T(const ExpressionInstance<T> &, size_t)> MainFunc;
@@ -279,49 +737,71 @@ template <class T> class Job {
   MainFunc main;
   RValFunc rval;
   size_t joblets;
+  // Instances assigned in advance to the first joblets
+  std::vector<ExpressionInstance<T> *> instances;
 
-  Job(Expression<T> *e) : main(), rval(), joblets(1), expression(e), persistent(), autoIndex(0){};
-
-  inline void persist(const std::string &key, const Napi::Object &obj) {
-    persistent[key] = obj;
+  Job(Expression<T> *e)
+    : main(), rval(), joblets(1), instances(), expression(e), persistent(Spares<std::vector<Napi::Object>>::take()){};
+  ~Job() {
+    Spares<std::vector<Napi::Object>>::give(std::move(persistent));
   }
 
   inline void persist(const Napi::Object &obj) {
-    persistent[std::to_string(autoIndex++)] = obj;
+    persistent.push_back(obj);
   }
 
   inline void persist(const std::vector<Napi::Object> &objs) {
     for (auto const &i : objs) persist(i);
   }
 
-  Napi::Value run(const Napi::CallbackInfo &info, bool async, int cb_arg) {
-    if (!info.This().IsEmpty() && info.This().IsObject()) persist("this", info.This().As<Napi::Object>());
+  Napi::Value run(const Napi::CallbackInfo &info, bool async, size_t cb_arg) {
+    if (!info.This().IsEmpty() && info.This().IsObject()) persist(info.This().As<Napi::Object>());
     if (async) {
       // Asynchronous execution by an AsyncWorker that will trigger a JS callback
       if (!info[cb_arg].IsFunction()) {
+        for (auto *i : instances) expression->releaseIdleInstance(i);
         Napi::TypeError::New(info.Env(), "The callback must be a function").ThrowAsJavaScriptException();
         return info.Env().Undefined();
       }
       Napi::Function callback = info[cb_arg].As<Napi::Function>();
-      auto worker = new AsyncWorker<T>(expression, callback, main, rval, joblets, persistent);
+      AdmissionGuard<T> admission(expression);
+      if (admission.Error() != nullptr) {
+        for (auto *i : instances) expression->releaseIdleInstance(i);
+        Napi::Error err = Napi::Error::New(info.Env(), admission.Error());
+        err.Value().Set("code", queueFullCode);
+        err.ThrowAsJavaScriptException();
+        return info.Env().Undefined();
+      }
+      // The Job is not used after this, its functions move to the Worker
+      auto worker =
+        new AsyncWorker<T>(expression, callback, std::move(main), std::move(rval), joblets, instances, persistent);
+      // From now on the worker releases the slot when it completes
+      admission.Commit();
+      // An abortable call receives the function that cancels its job
+      std::shared_ptr<Cancellation> cancellation = worker->GetCancellation();
       worker->Queue();
+      // The worker cannot be deleted before we return to the event loop
+      if (info.Length() > cb_arg + 1 && info[cb_arg + 1].IsFunction()) {
+        info[cb_arg + 1].As<Napi::Function>().Call(
+          {Napi::Function::New(info.Env(), [cancellation](const Napi::CallbackInfo &) { cancellation->cancel(); })});
+      }
       return info.Env().Undefined();
     }
-    if (joblets > 1) {
+    if (joblets > 1 || !instances.empty()) {
       // Synchronous multithreaded execution by an SyncWorker that will trigger
       // a C++ callback that will unlock a semaphore blocking the return to JS
       // C++ does not have semaphores until C++20 so a condition variable is used
       Semaphore sem(true); // initialized locked
-      auto worker = new SyncWorker<T>(expression, sem, main, rval, joblets);
-      worker->Queue(); // will unlock it
-      sem.lock();      // wait for the unlock
-      if (worker->Error() != nullptr) {
-        Napi::Error::New(info.Env(), worker->Error()).ThrowAsJavaScriptException();
+      // The worker lives on the stack, it cannot be destroyed before the unlock
+      SyncWorker<T> worker(expression, sem, std::move(main), std::move(rval), joblets, instances);
+      // The calling thread runs one of the joblets instead of sleeping
+      worker.QueueAndRun(); // the last joblet will unlock it
+      sem.lock();           // wait for the unlock
+      if (worker.Error() != nullptr) {
+        Napi::Error::New(info.Env(), worker.Error()).ThrowAsJavaScriptException();
         return info.Env().Undefined();
       }
-      T obj = worker->Result();
-      delete worker;
-      return rval(obj);
+      return worker.Value();
     }
     // Synchronous monothreaded execution in the main thread
     try {
@@ -336,10 +816,37 @@ template <class T> class Job {
 
     private:
   Expression<T> *expression;
-  std::map<std::string, Napi::Object> persistent;
-  unsigned autoIndex;
+  std::vector<Napi::Object> persistent;
 };
 
-void initAsyncWorkers(size_t threads);
+// The pool is shared by all environments, each one holds a reference
+// and the last one to exit stops it
+// Only the first one calls `configure` which sets the number of threads and
+// the pinning - it runs under the pool lock and is where the process-wide
+// settings are applied without racing with the other environments
+void acquireAsyncWorkers(const std::function<void(size_t &threads, bool &pin)> &configure);
+void releaseAsyncWorkers();
+size_t asyncWorkersUsers();
+// Grow or shrink the pool, the surplus workers exit after their current joblet
+void resizeAsyncWorkers(size_t threads);
+size_t asyncWorkers();
+size_t maxAsyncWorkers();
+// Pin each worker to one CPU (Linux only)
+void pinAsyncWorkers(bool pin);
+bool asyncWorkersPinned();
+QueueStats queueStats(Priority priority);
+// Admission control of the asynchronous calls,
+// the process-wide limit of pending calls, 0 is unlimited
+void setMaxQueued(size_t max);
+size_t maxQueued();
+// Reserve a slot for a new call, false if the limit has been reached
+bool admitAsyncJob();
+void releaseAsyncJob();
+void rejectAsyncJob();
+AdmissionStats admissionStats();
+DispatchCost dispatchCost();
+#ifdef EXPRTKJS_COUNT_ALLOCATIONS
+size_t heapAllocations();
+#endif
 
 }; // namespace exprtk_js
@@ -0,0 +1,43 @@
+#include "cache.h"
+
+using namespace exprtk_js;
+
+InstanceCache &exprtk_js::instanceCache() {
+  // Never destroyed, Expression objects can still be
+  // garbage-collected after the static destructors have run
+  static InstanceCache *cache = new InstanceCache(0);
+  return *cache;
+}
+
+void exprtk_js::initInstanceCache(size_t maxSize) {
+  instanceCache().resize(maxSize);
+}
+
+InstanceCache::LRUList InstanceCache::evict() {
+  LRUList evicted;
+  while (lru.size() > maxSize) {
+    auto last = std::prev(lru.end());
+    auto range = index.equal_range(last->first);
+    for (auto it = range.first; it != range.second; it++) {
+      if (it->second == last) {
+        index.erase(it);
+        break;
+      }
+    }
+    evicted.splice(evicted.end(), lru, last);
+    evictions++;
+  }
+  return evicted;
+}
+
+void InstanceCache::resize(size_t newMax) {
+  LRUList evicted;
+  std::lock_guard<std::mutex> guard(lock);
+  maxSize = newMax;
+  evicted = evict();
+}
+
+InstanceCache::Stats InstanceCache::stats() {
+  std::lock_guard<std::mutex> guard(lock);
+  return {lru.size(), maxSize, hits, misses, evictions};
+}
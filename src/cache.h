@@ -0,0 +1,116 @@
+#pragma once
+
+#include <list>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+
+namespace exprtk_js {
+
+template <class T> struct ExpressionInstance;
+
+/**
+ * A process-wide cache of compiled ExpressionInstances
+ *
+ * When an Expression is garbage-collected, its idle compiled instances
+ * are kept here and they are adopted by the next Expression with the
+ * same signature (type, expression text and symbol layout) instead of
+ * reparsing the expression.
+ *
+ * The cache is bounded by the total number of instances it holds,
+ * the least recently released ones are evicted first.
+ */
+class InstanceCache {
+    public:
+  struct Stats {
+    size_t size;
+    size_t maxSize;
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+  };
+
+  InstanceCache(size_t maxSize) : maxSize(maxSize), hits(0), misses(0), evictions(0) {
+  }
+
+  InstanceCache(const InstanceCache &) = delete;
+  InstanceCache &operator=(const InstanceCache &) = delete;
+
+  // Move a cached instance into an uncompiled one, returns false on a miss
+  template <typename T> bool acquire(const std::string &key, ExpressionInstance<T> &instance);
+  // Move a compiled instance into the cache, leaves behind an uncompiled one
+  template <typename T> void release(const std::string &key, ExpressionInstance<T> &instance);
+
+  void resize(size_t newMax);
+  Stats stats();
+
+    private:
+  struct GenericEntry {
+    virtual ~GenericEntry() = default;
+  };
+
+  template <typename T> struct Entry : public GenericEntry {
+    ExpressionInstance<T> instance;
+  };
+
+  typedef std::list<std::pair<std::string, std::unique_ptr<GenericEntry>>> LRUList;
+
+  // Must be called with the lock held, returns the evicted entries
+  // so that they can be destroyed after releasing the lock
+  LRUList evict();
+
+  std::mutex lock;
+  // Most recently released entries are at the front
+  LRUList lru;
+  std::multimap<std::string, LRUList::iterator> index;
+  size_t maxSize;
+  size_t hits;
+  size_t misses;
+  size_t evictions;
+};
+
+// this one is prone to static initialization fiasco
+// and it must outlive all Expression objects
+InstanceCache &instanceCache();
+
+void initInstanceCache(size_t maxSize);
+
+// ExprTk symbol tables and expressions are reference counted handles
+// and the reference counters are not atomic - this is why instances are
+// always swapped and never copied: once an instance is in the cache,
+// no other handle in another thread can share its control blocks
+template <typename T> bool InstanceCache::acquire(const std::string &key, ExpressionInstance<T> &instance) {
+  std::unique_ptr<GenericEntry> entry;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = index.find(key);
+    if (it == index.end()) {
+      misses++;
+      return false;
+    }
+    hits++;
+    entry = std::move(it->second->second);
+    lru.erase(it->second);
+    index.erase(it);
+  }
+
+  std::swap(static_cast<Entry<T> *>(entry.get())->instance, instance);
+  return true;
+}
+
+template <typename T> void InstanceCache::release(const std::string &key, ExpressionInstance<T> &instance) {
+  auto *entry = new Entry<T>;
+  std::swap(entry->instance, instance);
+
+  LRUList evicted;
+  {
+    std::lock_guard<std::mutex> guard(lock);
+    lru.emplace_front(key, std::unique_ptr<GenericEntry>(entry));
+    index.emplace(key, lru.begin());
+    evicted = evict();
+  }
+}
+
+} // namespace exprtk_js
@@ -10,6 +10,15 @@ namespace exprtk_js {
  * @param {string} expression function
  * @param {string[]} [variables] An array containing all the scalar variables' names, will be determined automatically if omitted, however order won't be guaranteed, scalars are passed by value
  * @param {Record<string, number>} [vectors] An object containing all the vector variables' names and their sizes, vector size must be known at compilation (object construction), vectors are passed by reference and can be modified by the ExprTk expression
+ * @param {object} [options] Additional options
+ * @param {number} [options.maxParallel] Initial value of the `maxParallel` property
+ * @param {number} [options.prepare] Number of instances to compile in parallel before returning, by default only one instance is compiled and the others are compiled on first use
+ * @param {Record<string, boolean>} [options.settings] ExprTk parser settings, all enabled by default: `replacer`, `joiner`, `numericCheck`, `bracketCheck`, `sequenceCheck`, `commutativeCheck`, `strengthReduction`, `localVariables`, `controlStructures`, `loops` and `assignments`
+ * @param {string} [options.backend] Evaluation backend of `map()` and `cwise()`, `tree` (default) walks the ExprTk tree, `vm` runs a register bytecode when the expression can be lowered to it, `block` runs the same bytecode on blocks of elements
+ * @param {string} [options.schedule] Initial value of the `schedule` property
+ * @param {string} [options.priority] Initial value of the `priority` property
+ * @param {number} [options.maxQueued] Initial value of the `maxQueued` property
+ * @param {string} [options.overflow] Initial value of the `overflow` property
  * @returns {Expression}
  * 
  * The `Expression` represents an expression compiled to an AST from a string. Expressions come in different flavors depending on the internal type used.
@@ -27,20 +36,42 @@ namespace exprtk_js {
  *  'for (var i := 0; i < x[]; i += 1) { sum += x[i]; sumsq += x[i] * x[i] }; ' +
  *  '(sumsq - (sum*sum) / x[]) / (x[] - 1);',
  *  [], {x: 1024})
+ *
+ * // compile all instances ahead of time
+ * const warm = new Expression('(a+b)/2', ['a', 'b'], undefined, {prepare: Expression.maxParallel});
+ *
+ * // a plain formula, without loops, assignments or local variables
+ * const formula = new Expression('a * b + c', ['a', 'b', 'c'], undefined,
+ *  {settings: {loops: false, assignments: false, localVariables: false}});
  */
 
-size_t ExpressionMaxParallel = std::thread::hardware_concurrency();
+size_t ExpressionCacheSize = 256;
+
+static inline std::string maxInstancesError(size_t threads) {
+  return "maximum instances is limited to the number of threads set by the environment variable EXPRTKJS_THREADS "
+         "or by Expression.maxParallel : " +
+    std::to_string(threads);
+}
+
 template <typename T>
 Expression<T>::Expression(const Napi::CallbackInfo &info)
   : Napi::ObjectWrap<Expression<T>>::ObjectWrap(info),
-    maxParallel(ExpressionMaxParallel),
+    backend(Backend::Tree),
+    schedule(Schedule::Static),
+    priority(Priority::Normal),
+    elementCost(),
+    maxQueued(0),
+    pendingJobs(0),
+    overflow(Overflow::Reject),
+    maxParallel(asyncWorkers()),
     maxActive(1),
     currentActive(0),
-    instances(ExpressionMaxParallel),
+    instances(maxParallel),
+    instancesAllocated(1),
     capiDescriptor(nullptr) {
   Napi::Env env = info.Env();
+  instances[0].reset(new ExpressionInstance<T>);
 
-  instances[0].isInit = false;
   if (info.Length() < 1) {
     Napi::TypeError::New(env, "expression is mandatory").ThrowAsJavaScriptException();
     return;
@@ -52,7 +83,124 @@ Expression<T>::Expression(const Napi::CallbackInfo &info)
   }
   expressionText = info[0].As<Napi::String>().Utf8Value();
 
-  if (info.Length() > 1) {
+  size_t prepare = 1;
+  Backend requestedBackend = Backend::Tree;
+  if (info.Length() > 3 && !info[3].IsUndefined()) {
+    if (!info[3].IsObject()) {
+      Napi::TypeError::New(env, "options must be an object").ThrowAsJavaScriptException();
+      return;
+    }
+    Napi::Object options = info[3].As<Napi::Object>();
+    if (options.Has("maxParallel")) {
+      Napi::Value value = options.Get("maxParallel");
+      if (!value.IsNumber()) {
+        Napi::TypeError::New(env, "maxParallel must be a number").ThrowAsJavaScriptException();
+        return;
+      }
+      maxParallel = value.ToNumber().Uint32Value();
+      // NaN and the negative fractions are 0 too
+      if (maxParallel < 1) {
+        Napi::TypeError::New(env, "maxParallel must be between 1 and " + std::to_string(instances.size()))
+          .ThrowAsJavaScriptException();
+        return;
+      }
+      if (maxParallel > instances.size()) {
+        Napi::TypeError::New(env, maxInstancesError(instances.size())).ThrowAsJavaScriptException();
+        return;
+      }
+    }
+    if (options.Has("prepare")) {
+      Napi::Value value = options.Get("prepare");
+      if (!value.IsNumber()) {
+        Napi::TypeError::New(env, "prepare must be a number").ThrowAsJavaScriptException();
+        return;
+      }
+      prepare = value.ToNumber().Uint32Value();
+      if (prepare > maxParallel) {
+        Napi::TypeError::New(env, "prepare must not exceed maxParallel = " + std::to_string(maxParallel))
+          .ThrowAsJavaScriptException();
+        return;
+      }
+    }
+    if (options.Has("settings")) {
+      if (!options.Get("settings").IsObject()) {
+        Napi::TypeError::New(env, "settings must be an object").ThrowAsJavaScriptException();
+        return;
+      }
+      Napi::Object opts = options.Get("settings").As<Napi::Object>();
+      Napi::Array optNames = opts.GetPropertyNames();
+      for (std::size_t i = 0; i < optNames.Length(); i++) {
+        const std::string name = optNames.Get(i).As<Napi::String>().Utf8Value();
+        const ParserSettings::Name *opt = nullptr;
+        for (auto const &n : ParserSettings::names)
+          if (name == n.name) opt = &n;
+        if (opt == nullptr) {
+          Napi::TypeError::New(env, name + " is not a valid parser setting").ThrowAsJavaScriptException();
+          return;
+        }
+        Napi::Value value = opts.Get(name);
+        if (!value.IsBoolean()) {
+          Napi::TypeError::New(env, "parser settings must be booleans").ThrowAsJavaScriptException();
+          return;
+        }
+        settings.set(opt->flag, value.ToBoolean().Value());
+      }
+    }
+    if (options.Has("backend")) {
+      Napi::Value value = options.Get("backend");
+      std::string backend = value.IsString() ? value.As<Napi::String>().Utf8Value() : "";
+      if (backend == "vm")
+        requestedBackend = Backend::VM;
+      else if (backend == "block")
+        requestedBackend = Backend::Block;
+      else if (backend != "tree") {
+        Napi::TypeError::New(env, "backend must be 'tree', 'vm' or 'block'").ThrowAsJavaScriptException();
+        return;
+      }
+    }
+    if (options.Has("schedule")) {
+      Napi::Value value = options.Get("schedule");
+      std::string name = value.IsString() ? value.As<Napi::String>().Utf8Value() : "";
+      if (name == "dynamic")
+        schedule = Schedule::Dynamic;
+      else if (name != "static") {
+        Napi::TypeError::New(env, "schedule must be 'static' or 'dynamic'").ThrowAsJavaScriptException();
+        return;
+      }
+    }
+    if (options.Has("priority")) {
+      Napi::Value value = options.Get("priority");
+      std::string name = value.IsString() ? value.As<Napi::String>().Utf8Value() : "";
+      if (name == "high")
+        priority = Priority::High;
+      else if (name == "bulk")
+        priority = Priority::Bulk;
+      else if (name != "normal") {
+        Napi::TypeError::New(env, "priority must be 'high', 'normal' or 'bulk'").ThrowAsJavaScriptException();
+        return;
+      }
+    }
+    if (options.Has("maxQueued")) {
+      Napi::Value value = options.Get("maxQueued");
+      if (!value.IsNumber()) {
+        Napi::TypeError::New(env, "maxQueued must be a number").ThrowAsJavaScriptException();
+        return;
+      }
+      maxQueued = value.ToNumber().Uint32Value();
+    }
+    if (options.Has("overflow")) {
+      Napi::Value value = options.Get("overflow");
+      std::string name = value.IsString() ? value.As<Napi::String>().Utf8Value() : "";
+      if (name == "wait")
+        overflow = Overflow::Wait;
+      else if (name != "reject") {
+        Napi::TypeError::New(env, "overflow must be 'reject' or 'wait'").ThrowAsJavaScriptException();
+        return;
+      }
+    }
+  }
+
+  if (info.Length() > 1 && !info[1].IsUndefined()) {
     if (!info[1].IsArray()) {
       Napi::TypeError::New(env, "arguments must be an array").ThrowAsJavaScriptException();
       return;
@@ -60,7 +208,7 @@ Expression<T>::Expression(const Napi::CallbackInfo &info)
     Napi::Array args = info[1].As<Napi::Array>();
     for (std::size_t i = 0; i < args.Length(); i++) {
       const std::string name = args.Get(i).As<Napi::String>().Utf8Value();
-      if (!instances[0].symbolTable.create_variable(name)) {
+      if (!instances[0]->symbolTable.create_variable(name)) {
         Napi::TypeError::New(env, name + " is not a valid variable name").ThrowAsJavaScriptException();
         return;
       }
@@ -70,7 +218,7 @@ Expression<T>::Expression(const Napi::CallbackInfo &info)
     std::vector<std::string> args;
     exprtk::collect_variables(expressionText, args);
     for (const auto &name : args) {
-      if (!instances[0].symbolTable.create_variable(name)) {
+      if (!instances[0]->symbolTable.create_variable(name)) {
         Napi::TypeError::New(env, name + " is not a valid variable name").ThrowAsJavaScriptException();
         return;
       }
@@ -78,7 +226,7 @@ Expression<T>::Expression(const Napi::CallbackInfo &info)
     }
   }
 
-  if (info.Length() > 2) {
+  if (info.Length() > 2 && !info[2].IsUndefined()) {
     if (!info[2].IsObject()) {
       Napi::TypeError::New(env, "vectors must be an object").ThrowAsJavaScriptException();
       return;
@@ -99,9 +247,9 @@ Expression<T>::Expression(const Napi::CallbackInfo &info)
       // However it will happily swallow an invalid pointer
       size_t size = value.ToNumber().Int64Value();
       T *dummy = (T *)&size;
-      instances[0].vectorViews[name] = std::make_unique<exprtk::vector_view<T>>(dummy, size);
+      instances[0]->vectorViews[name] = std::make_unique<exprtk::vector_view<T>>(dummy, size);
 
-      if (!instances[0].symbolTable.add_vector(name, *instances[0].vectorViews[name])) {
+      if (!instances[0]->symbolTable.add_vector(name, *instances[0]->vectorViews[name])) {
         Napi::TypeError::New(env, name + " is not a valid vector name").ThrowAsJavaScriptException();
         return;
       }
@@ -110,34 +258,56 @@ Expression<T>::Expression(const Napi::CallbackInfo &info)
     }
   }
 
-  instances[0].expression.register_symbol_table(instances[0].symbolTable);
-
-  std::lock_guard<std::mutex> lock(parserMutex);
-  if (!parser().compile(expressionText, instances[0].expression)) {
-    std::string errorText = "failed compiling expression " + expressionText + "\n";
-    for (std::size_t i = 0; i < parser().error_count(); i++) {
-      exprtk::parser_error::type error = parser().get_error(i);
-      errorText += exprtk::parser_error::to_str(error.mode) + " at " + std::to_string(error.token.position) + " : " +
-        error.diagnostic + "\n";
+  // The signature is the type, the parser settings, the expression
+  // and the symbol layout which is the ordered list of scalars followed by the vectors with their sizes
+  cacheKey = std::string(NapiArrayType<T>::name) + "\n" + std::to_string(settings.flags) + "\n";
+  for (auto const &name : variableNames) {
+    auto vector = instances[0]->symbolTable.get_vector(name);
+    cacheKey += vector == nullptr ? name + "," : name + "[" + std::to_string(vector->size()) + "],";
+  }
+  cacheKey += "\n" + expressionText;
+
+  if (!instanceCache().acquire(cacheKey, *instances[0])) {
+    instances[0]->expression.register_symbol_table(instances[0]->symbolTable);
+
+    ParserGuard<T> parser(settings);
+    parser->register_loop_runtime_check(*instances[0]->loopInterrupt);
+    bool compiled = parser->compile(expressionText, instances[0]->expression);
+    parser->clear_loop_runtime_check();
+    if (!compiled) {
+      std::string errorText = "failed compiling expression " + expressionText + "\n";
+      for (std::size_t i = 0; i < parser->error_count(); i++) {
+        exprtk::parser_error::type error = parser->get_error(i);
+        errorText += exprtk::parser_error::to_str(error.mode) + " at " + std::to_string(error.token.position) +
+          " : " + error.diagnostic + "\n";
+      }
+      Napi::Error::New(env, errorText).ThrowAsJavaScriptException();
+      return;
     }
-    Napi::Error::New(env, errorText).ThrowAsJavaScriptException();
+    instances[0]->isInit = true;
   }
 
-  instances[0].isInit = true;
-  instancesIdle.push_back(&instances[0]);
-  for (size_t i = 1; i < ExpressionMaxParallel; i++) {
-    instances[i].isInit = false;
-    instancesIdle.push_back(&instances[i]);
+  instancesIdle.push_back(instances[0].get());
+
+  // Expressions that cannot be lowered silently fall back to the tree
+  if (requestedBackend != Backend::Tree) {
+    program = vm::Program<T>::lower(instances[0]->expression, instances[0]->symbolTable);
+    if (program) backend = requestedBackend;
   }
+
+  if (prepare > 1) runPrepare(info, prepare, false);
 }
 
 template <typename T> Expression<T>::~Expression() {
   std::lock_guard<std::mutex> lock(asyncLock);
-  if (instances[0].isInit) {
+  if (instances[0]->isInit) {
     size_t free = 0;
-    for (; !instancesIdle.empty(); instancesIdle.pop_front(), free++)
-      ;
-    if (free != instances.size())
+    for (; !instancesIdle.empty(); instancesIdle.pop_front(), free++) {
+      // Idle compiled instances are recycled by the process-wide cache
+      auto *i = instancesIdle.front();
+      if (i->isInit) instanceCache().release(cacheKey, *i);
+    }
+    if (free != instancesAllocated)
       fprintf(
         stderr,
         "GC waiting on a background evaluation of an Expression object, event loop blocked. "
@@ -145,25 +315,23 @@ template <typename T> Expression<T>::~Expression() {
         "If you are using the C/C++ API, you must always protect Expression objects from the GC "
         "by obtaining a persistent object reference. \n");
   }
-  for (auto &i : instances) {
-    if (i.isInit) {
-      for (auto const &v : i.vectorViews) {
-        // exprtk will sometimes try to free this pointer
-        // on object destruction even if it never allocated it
-        v.second->rebase((T *)nullptr);
-      }
-      i.vectorViews.clear();
-    }
-  }
 }
 
 template <typename T> void Expression<T>::compileInstance(ExpressionInstance<T> *i) {
   if (i->isInit) return;
+  maxActive++;
+  if (instanceCache().acquire(cacheKey, *i)) return;
+  // instances can be grown by the main thread while this runs in a worker
+  ExpressionInstance<T> *reference;
+  {
+    std::lock_guard<std::mutex> lock(asyncLock);
+    reference = instances[0].get();
+  }
   for (auto const &name : variableNames) {
-    if (instances[0].symbolTable.get_variable(name))
+    if (reference->symbolTable.get_variable(name))
       i->symbolTable.create_variable(name);
     else {
-      auto vector = instances[0].symbolTable.get_vector(name);
+      auto vector = reference->symbolTable.get_vector(name);
       auto size = vector->size();
       T *dummy = (T *)&size;
       i->vectorViews[name] = std::make_unique<exprtk::vector_view<T>>(dummy, size);
@@ -172,9 +340,66 @@ template <typename T> void Expression<T>::compileInstance(ExpressionInstance<T>
   }
   i->isInit = true;
   i->expression.register_symbol_table(i->symbolTable);
-  std::lock_guard<std::mutex> lock(parserMutex);
-  maxActive++;
-  parser().compile(expressionText, i->expression);
+  ParserGuard<T> parser(settings);
+  parser->register_loop_runtime_check(*i->loopInterrupt);
+  parser->compile(expressionText, i->expression);
+  parser->clear_loop_runtime_check();
+}
+
+template <typename T> Napi::Value Expression<T>::runPrepare(const Napi::CallbackInfo &info, size_t n, bool async) {
+  Napi::Env env = info.Env();
+
+  Job<T> job(this);
+
+  job.instances = reserveUncompiledInstances(n);
+  size_t compiled = job.instances.size();
+  // Nothing to compile still requires one (empty) joblet to produce the result
+  job.joblets = compiled > 0 ? compiled : 1;
+
+  // The compilation happens in Worker::OnExecute before calling main
+  job.main = [](const ExpressionInstance<T> &, size_t) { return T(); };
+  job.rval = [env, compiled](T) { return Napi::Number::New(env, compiled); };
+  return job.run(info, async, callbackArg(info));
+}
+
+/**
+ * Compile ahead of time the instances used for parallel evaluation.
+ *
+ * By default, only one instance is compiled when the Expression is constructed
+ * and the others are compiled in the worker threads on first use.
+ * This method compiles in parallel as many instances as needed so that
+ * at least `instances` instances are ready.
+ *
+ * Returns the number of newly compiled instances.
+ *
+ * @instance
+ * @param {number} [instances] Number of instances to prepare, defaults to `maxParallel`
+ * @returns {number}
+ * @memberof Expression
+ *
+ * @example
+ * const mean = new Expression('(a+b)/2', ['a', 'b']);
+ * await mean.prepareAsync();
+ * // mean.mapAsync() will not have to compile anything
+ */
+ASYNCABLE_DEFINE(template <typename T>, Expression<T>::prepare) {
+  Napi::Env env = info.Env();
+
+  size_t n = maxParallel;
+  if (info.Length() > 0 && !info[0].IsFunction() && !info[0].IsUndefined()) {
+    if (!info[0].IsNumber()) {
+      Napi::TypeError::New(env, "instances must be a number").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    n = info[0].ToNumber().Uint32Value();
+    if (n > maxParallel) {
+      Napi::TypeError::New(env, "instances must not exceed maxParallel = " + std::to_string(maxParallel))
+        .ThrowAsJavaScriptException();
+      return env.Null();
+    }
+  }
+
+  return runPrepare(info, n, async);
 }
 
 template <typename T> static inline T *GetTypedArrayPtr(const Napi::TypedArray &array) {
@@ -199,6 +424,9 @@ template <typename T> static inline T *GetTypedArrayPtr(const Napi::TypedArray &
  * // These two are equivalent
  * expr.evalAsync({a: 2, b: 5}, (e,r) => console.log(e, r));
  * expr.evalAsync(2, 5, (e,r) => console.log(e, r));
+ *
+ * // An AbortSignal after the arguments cancels the evaluation
+ * const r3 = await expr.evalAsync({a: 2, b: 5}, AbortSignal.timeout(100));
  */
 ASYNCABLE_DEFINE(template <typename T>, Expression<T>::eval) {
   Napi::Env env = info.Env();
@@ -213,11 +441,11 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::eval) {
 
   if (info.Length() > 0 && (info[0].IsNumber() || info[0].IsTypedArray())) {
     size_t last = info.Length();
-    if (async && last > 0 && info[last - 1].IsFunction()) last--;
+    if (async && last > 0 && info[last - 1].IsFunction()) last = callbackArg(info);
     importFromArgumentsArray(env, job, info, 0, last, importers);
   }
 
-  if (instances[0].symbolTable.variable_count() + instances[0].symbolTable.vector_count() != importers.size()) {
+  if (instances[0]->symbolTable.variable_count() + instances[0]->symbolTable.vector_count() != importers.size()) {
     Napi::TypeError::New(env, "wrong number of input arguments").ThrowAsJavaScriptException();
     return env.Null();
   }
@@ -229,7 +457,7 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::eval) {
     return r;
   };
   job.rval = [env](T r) { return Napi::Number::New(env, r); };
-  return job.run(info, async, info.Length() - 1);
+  return job.run(info, async, callbackArg(info));
 }
 
 template <typename T> exprtk_result Expression<T>::capi_eval(const void *_scalars, void **_vectors, void *_result) {
@@ -260,9 +488,13 @@ template <typename T> exprtk_result Expression<T>::capi_eval(const void *_scalar
  * This can be used when multiple operations are chained to avoid reallocating a new array at every step.
  * Otherwise it will return a new array.
  *
+ * If target is an array of TypedArrays, the expression must end with `return [a, b, ...]`
+ * and every returned value is written into its own target during the same traversal.
+ * In this case the array of targets is returned.
+ *
  * @instance
- * @param {TypedArray<T>} [threads] number of threads to use, 1 if not specified
- * @param {TypedArray<T>} [target] array in which the data is to be written, will allocate a new array if none is specified
+ * @param {number|'auto'} [threads] number of threads to use, 1 if not specified, `'auto'` picks it from the array length and the measured cost per element
+ * @param {TypedArray<T>|TypedArray<T>[]} [target] array in which the data is to be written, will allocate a new array if none is specified
  * @param {TypedArray<T>} array for the expression to be iterated over
  * @param {string} iterator variable name
  * @param {...(number|TypedArray<T>)[]|Record<string, number|TypedArray<T>>} arguments of the function, iterator removed
@@ -293,6 +525,13 @@ template <typename T> exprtk_result Expression<T>::capi_eval(const void *_scalar
  * // Using multiple (4) parallel threads (OpenMP-style parallelism)
  * const r1 = expr.map(4, array, 'x', 0, 1000);
  * const r2 = await expr.mapAsync(4, array, 'x', {f: 0, c: 0});
+ *
+ * // Letting ExprTk.js choose the number of threads
+ * const r3 = expr.map('auto', array, 'x', 0, 1000);
+ *
+ * // Several results in one pass
+ * const sincos = new Expression('return [sin(x), cos(x)]', ['x']);
+ * const [sin, cos] = sincos.map([new Float64Array(array.length), new Float64Array(array.length)], array, 'x');
  */
 ASYNCABLE_DEFINE(template <typename T>, Expression<T>::map) {
   Napi::Env env = info.Env();
@@ -302,6 +541,7 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::map) {
   std::vector<std::function<void(const ExpressionInstance<T> &)>> importers;
 
   size_t arg = 0;
+  bool autoThreads = false;
   if (info.Length() > arg + 1 && info[arg].IsNumber()) {
     job.joblets = static_cast<size_t>(info[0].ToNumber().Uint32Value());
     arg++;
@@ -310,10 +550,35 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::map) {
         .ThrowAsJavaScriptException();
       return env.Null();
     }
+  } else if (info.Length() > arg + 1 && info[arg].IsString()) {
+    if (info[arg].As<Napi::String>().Utf8Value() != "auto") {
+      Napi::TypeError::New(env, "threads must be a number or 'auto'").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    autoThreads = true;
+    arg++;
   }
 
   Napi::TypedArray result;
-  if (info.Length() > arg + 1 && info[arg + 1].IsTypedArray()) {
+  Napi::Array targets;
+  if (info.Length() > arg + 1 && info[arg].IsArray()) {
+    // The caller passed one array per returned value
+    targets = info[arg].As<Napi::Array>();
+    if (targets.Length() == 0) {
+      Napi::TypeError::New(env, "target arrays must not be empty").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    for (uint32_t j = 0; j < targets.Length(); j++) {
+      Napi::Value target = targets.Get(j);
+      if (!target.IsTypedArray() || target.As<Napi::TypedArray>().TypedArrayType() != NapiArrayType<T>::type) {
+        Napi::TypeError::New(env, "target arrays must be " + std::string(NapiArrayType<T>::name) + "Arrays")
+          .ThrowAsJavaScriptException();
+        return env.Null();
+      }
+    }
+    result = targets.Get(0u).As<Napi::TypedArray>();
+    arg++;
+  } else if (info.Length() > arg + 1 && info[arg + 1].IsTypedArray()) {
     // The caller passed a preallocated array
     result = info[arg].As<Napi::TypedArray>();
     if (result.TypedArrayType() != NapiArrayType<T>::type) {
@@ -336,8 +601,21 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::map) {
   Napi::TypedArray array = info[arg++].As<Napi::TypedArray>();
   T *input = GetTypedArrayPtr<T>(array);
   size_t lenTotal = array.ElementLength();
+  // The new array must not be written here: large zero-filled buffers come directly from the OS
+  // and each page is allocated on the NUMA node of the worker thread that writes it first
   if (result.IsEmpty()) { result = NapiArrayType<T>::New(env, lenTotal); }
 
+  std::vector<T *> outputs;
+  for (uint32_t j = 0; !targets.IsEmpty() && j < targets.Length(); j++) {
+    Napi::TypedArray target = targets.Get(j).As<Napi::TypedArray>();
+    if (target.ElementLength() != array.ElementLength()) {
+      Napi::TypeError::New(env, "all target arrays must have the same size as the input array")
+        .ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    outputs.push_back(GetTypedArrayPtr<T>(target));
+  }
+
   if (result.ElementLength() != array.ElementLength()) {
     Napi::TypeError::New(env, "both arrays must have the same size").ThrowAsJavaScriptException();
     return env.Null();
@@ -348,7 +626,7 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::map) {
     return env.Null();
   }
   const std::string iteratorName = info[arg++].As<Napi::String>().Utf8Value();
-  auto iterator = instances[0].symbolTable.get_variable(iteratorName);
+  auto iterator = instances[0]->symbolTable.get_variable(iteratorName);
   if (iterator == nullptr) {
     Napi::TypeError::New(env, iteratorName + " is not a declared scalar variable").ThrowAsJavaScriptException();
     return env.Null();
@@ -360,42 +638,69 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::map) {
 
   if (info.Length() > arg && (info[arg].IsNumber() || info[arg].IsTypedArray())) {
     size_t last = info.Length();
-    if (async && last > 2 && info[last - 1].IsFunction()) last--;
+    if (async && last > 2 && info[last - 1].IsFunction()) last = callbackArg(info);
     importFromArgumentsArray(env, job, info, arg, last, importers, {iteratorName});
   }
 
-  if (instances[0].symbolTable.variable_count() + instances[0].symbolTable.vector_count() != importers.size() + 1) {
+  if (instances[0]->symbolTable.variable_count() + instances[0]->symbolTable.vector_count() != importers.size() + 1) {
     Napi::TypeError::New(env, "wrong number of input arguments").ThrowAsJavaScriptException();
     return env.Null();
   }
 
   T *output = GetTypedArrayPtr<T>(result);
 
-  // integer division ceiling
-  size_t lenPerJoblet = (lenTotal + job.joblets - 1) / job.joblets;
+  if (autoThreads) job.joblets = autoJoblets(lenTotal, async);
+  Partition partition(schedule, lenTotal, job.joblets, priority, &elementCost);
 
   // this should have been an unique_ptr
   // but std::function is not compatible with move semantics
-  auto persistent = std::make_shared<Napi::Reference<Napi::TypedArray>>(Napi::Persistent(result));
-
-  job.main =
-    [importers, iteratorName, input, output, lenTotal, lenPerJoblet](const ExpressionInstance<T> &i, size_t id) {
-      for (auto const &f : importers) f(i);
-      auto iterator = i.symbolTable.get_variable(iteratorName);
-
-      T *it_ptr = &iterator->ref();
-      T *in_ptr = input + id * lenPerJoblet;
-      T *out_ptr = output + id * lenPerJoblet;
-      const T *in_end = input + std::min(lenTotal, (id + 1) * lenPerJoblet);
-      auto &expression = i.expression;
-      for (; in_ptr < in_end; in_ptr++, out_ptr++) {
-        *it_ptr = *in_ptr;
-        *out_ptr = expression.value();
+  auto persistent = std::make_shared<Napi::Reference<Napi::Object>>(
+    Napi::Persistent(targets.IsEmpty() ? result.As<Napi::Object>() : targets.As<Napi::Object>()));
+
+  auto bytecode = program;
+  auto backend = this->backend;
+  job.main = [importers, iteratorName, input, output, outputs, partition, bytecode, backend](
+               const ExpressionInstance<T> &i, size_t id) {
+    for (auto const &f : importers) f(i);
+    auto iterator = i.symbolTable.get_variable(iteratorName);
+
+    T *it_ptr = &iterator->ref();
+    auto range = partition.range(id);
+    size_t start, end;
+
+    if (!outputs.empty()) {
+      // Multiple return values, always evaluated by the tree
+      const size_t n = outputs.size();
+      std::unique_ptr<T[]> values(new T[n]);
+      while (range.next(start, end)) {
+        for (size_t k = start; k < end; k++) {
+          *it_ptr = input[k];
+          returnedValues(i.expression, i.expression.value(), values.get(), n);
+          for (size_t j = 0; j < n; j++) outputs[j][k] = values[j];
+        }
       }
       return 0;
-    };
+    }
+
+    vm::Polynomial<T> polynomial;
+    if (backend == Backend::Block && polynomial.fit(*bytecode, i.symbolTable, iteratorName)) {
+      while (range.next(start, end)) polynomial(input + start, output + start, end - start);
+      return 0;
+    }
+
+    Evaluator<T> evaluate(backend, bytecode, i.expression, i.symbolTable);
+    while (range.next(start, end)) {
+      T *out_ptr = output + start;
+      for (const T *in_ptr = input + start, *in_end = input + end; in_ptr < in_end; in_ptr++, out_ptr++) {
+        *it_ptr = *in_ptr;
+        evaluate(out_ptr);
+      }
+    }
+    evaluate.flush();
+    return 0;
+  };
   job.rval = [persistent](T r) { return persistent->Value(); };
-  return job.run(info, async, info.Length() - 1);
+  return job.run(info, async, callbackArg(info));
 }
 
 template <typename T>
@@ -430,11 +735,19 @@ exprtk_result Expression<T>::capi_map(
   const T *in_ptr = reinterpret_cast<const T *>(_iterator_vector);
   T *out_ptr = reinterpret_cast<T *>(_result);
   auto const in_end = in_ptr + iterator_len;
-  auto &expression = instance()->expression;
+
+  vm::Polynomial<T> polynomial;
+  if (backend == Backend::Block && polynomial.fit(*program, instance()->symbolTable, iterator_name)) {
+    polynomial(in_ptr, out_ptr, iterator_len);
+    return exprtk_ok;
+  }
+
+  Evaluator<T> evaluate(backend, program, instance()->expression, instance()->symbolTable);
   for (; in_ptr < in_end; in_ptr++, out_ptr++) {
     *it_ptr = *in_ptr;
-    *out_ptr = expression.value();
+    evaluate(out_ptr);
   }
+  evaluate.flush();
   return exprtk_ok;
 }
 
@@ -493,7 +806,7 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::reduce) {
     return env.Null();
   }
   const std::string iteratorName = info[1].As<Napi::String>().Utf8Value();
-  auto iterator = instances[0].symbolTable.get_variable(iteratorName);
+  auto iterator = instances[0]->symbolTable.get_variable(iteratorName);
   if (iterator == nullptr) {
     Napi::TypeError::New(env, iteratorName + " is not a declared scalar variable").ThrowAsJavaScriptException();
     return env.Null();
@@ -504,7 +817,7 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::reduce) {
     return env.Null();
   }
   const std::string accuName = info[2].As<Napi::String>().Utf8Value();
-  auto accu = instances[0].symbolTable.get_variable(accuName);
+  auto accu = instances[0]->symbolTable.get_variable(accuName);
   if (accu == nullptr) {
     Napi::TypeError::New(env, accuName + " is not a declared scalar variable").ThrowAsJavaScriptException();
     return env.Null();
@@ -523,11 +836,11 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::reduce) {
 
   if (info.Length() > 4 && (info[4].IsNumber() || info[4].IsTypedArray())) {
     size_t last = info.Length();
-    if (async && last > 4 && info[last - 1].IsFunction()) last--;
+    if (async && last > 4 && info[last - 1].IsFunction()) last = callbackArg(info);
     importFromArgumentsArray(env, job, info, 4, last, importers, {iteratorName, accuName});
   }
 
-  if (instances[0].symbolTable.variable_count() + instances[0].symbolTable.vector_count() != importers.size() + 2) {
+  if (instances[0]->symbolTable.variable_count() + instances[0]->symbolTable.vector_count() != importers.size() + 2) {
     Napi::TypeError::New(env, "wrong number of input arguments").ThrowAsJavaScriptException();
     return env.Null();
   }
@@ -540,16 +853,20 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::reduce) {
     accu->ref() = accuInit;
     T *it_ptr = &iterator->ref();
     T *accu_ptr = &accu->ref();
-    T *input_end = input + len;
     auto &expression = i.expression;
-    for (T *i = input; i < input_end; i++) {
-      *it_ptr = *i;
-      *accu_ptr = expression.value();
+    const Cancellation *cancellation = currentCancellation;
+    for (size_t start = 0; start < len; start += Partition::maxChunkSize) {
+      if (cancellation != nullptr && cancellation->cancelled()) throw abortedError;
+      T *chunk_end = input + std::min(len, start + Partition::maxChunkSize);
+      for (T *i = input + start; i < chunk_end; i++) {
+        *it_ptr = *i;
+        *accu_ptr = expression.value();
+      }
     }
     return accu->value();
   };
   job.rval = [env](T r) { return Napi::Number::New(env, r); };
-  return job.run(info, async, info.Length() - 1);
+  return job.run(info, async, callbackArg(info));
 }
 
 template <typename T>
@@ -607,6 +924,8 @@ template <typename T> struct symbolDesc {
   size_t elementSize;
   T *exprtk_var;
   NapiFromCaster_t<T> fromCaster;
+  // for targets only
+  NapiToCaster_t<T> toCaster;
 
   // for ndarrays only
   int64_t offset;
@@ -704,11 +1023,15 @@ static const size_t NapiElementSize[] = {
  * When mixing linear vectors and N-dimensional arrays, the linear vectors are considered to be in positive row-major order
  * in relation to the N-dimensional arrays.
  *
+ * An expression ending with `return [a, b, ...]` can write all its values in a single traversal
+ * when target is an array of TypedArrays, one per returned value, each one of any type.
+ * In this case the array of targets is returned.
+ *
  * @instance
- * @param {number} [threads]
+ * @param {number|'auto'} [threads] number of threads to use, 1 if not specified, `'auto'` picks it from the array length and the measured cost per element
  * @param {Record<string, number|TypedArray<any> | ndarray.NdArray<any> | stdlib.ndarray>} arguments
- * @param {TypedArray<T>} [target]
- * @returns {TypedArray<T>}
+ * @param {TypedArray<T>|TypedArray<any>[]} [target]
+ * @returns {TypedArray<T>|TypedArray<any>[]}
  * @memberof Expression
  *
  * @example
@@ -752,6 +1075,10 @@ static const size_t NapiElementSize[] = {
  * 
  * // async multithreaded
  * await density.cwiseAsync(os.cpus().length, {phi, T, P, R, Md, Mv}, result);
+ *
+ * // Cartesian to polar coordinates in one pass
+ * const polar = new Float64Expression('return [hypot(x, y), atan2(y, x)]', ['x', 'y']);
+ * const [r, theta] = polar.cwise({x, y}, [new Float64Array(x.length), new Float32Array(x.length)]);
  */
 ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
   Napi::Env env = info.Env();
@@ -759,6 +1086,7 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
   Job<T> job(this);
 
   size_t arg = 0;
+  bool autoThreads = false;
   if (info.Length() > arg + 1 && info[arg].IsNumber()) {
     job.joblets = static_cast<size_t>(info[0].ToNumber().Uint32Value());
     arg++;
@@ -767,6 +1095,13 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
         .ThrowAsJavaScriptException();
       return env.Null();
     }
+  } else if (info.Length() > arg + 1 && info[arg].IsString()) {
+    if (info[arg].As<Napi::String>().Utf8Value() != "auto") {
+      Napi::TypeError::New(env, "threads must be a number or 'auto'").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    autoThreads = true;
+    arg++;
   }
 
   if (info.Length() < 1 || !info[arg].IsObject()) {
@@ -777,14 +1112,17 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
   Napi::Object args = info[arg].As<Napi::Object>();
   arg++;
 
-  if (instances[0].symbolTable.vector_count() > 0) {
+  if (instances[0]->symbolTable.vector_count() > 0) {
     Napi::TypeError::New(env, "cwise()/cwiseAsync() are not compatible with vector arguments")
       .ThrowAsJavaScriptException();
     return env.Null();
   }
 
-  if (info.Length() >= arg + 1 && !info[arg].IsTypedArray() && (!async || !info[arg].IsFunction())) {
-    Napi::TypeError::New(env, "last argument must be a TypedArray or undefined").ThrowAsJavaScriptException();
+  if (
+    info.Length() >= arg + 1 && !info[arg].IsTypedArray() && !info[arg].IsArray() &&
+    (!async || !info[arg].IsFunction())) {
+    Napi::TypeError::New(env, "last argument must be a TypedArray, an array of TypedArrays or undefined")
+      .ThrowAsJavaScriptException();
     return env.Null();
   }
 
@@ -797,7 +1135,7 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
   for (std::size_t i = 0; i < argNames.Length(); i++) {
     const std::string name = argNames.Get(i).As<Napi::String>().Utf8Value();
     Napi::Value value = args.Get(name);
-    auto exprtk_ptr = instances[0].symbolTable.get_variable(name);
+    auto exprtk_ptr = instances[0]->symbolTable.get_variable(name);
     if (exprtk_ptr == nullptr) {
       Napi::TypeError::New(env, name + " is not a declared scalar variable").ThrowAsJavaScriptException();
       return env.Null();
@@ -864,7 +1202,7 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
     }
   }
 
-  if (instances[0].symbolTable.variable_count() != scalars.size() + vectors.size() + ndarrays.size()) {
+  if (instances[0]->symbolTable.variable_count() != scalars.size() + vectors.size() + ndarrays.size()) {
     Napi::TypeError::New(env, "wrong number of input arguments").ThrowAsJavaScriptException();
     return env.Null();
   }
@@ -875,7 +1213,34 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
   }
 
   Napi::TypedArray result;
-  if (info.Length() >= arg + 1 && info[arg].IsTypedArray()) {
+  Napi::Array targets;
+  std::vector<symbolDesc<T>> outputs;
+  if (info.Length() >= arg + 1 && info[arg].IsArray()) {
+    targets = info[arg].As<Napi::Array>();
+    if (targets.Length() == 0) {
+      Napi::TypeError::New(env, "target arrays must not be empty").ThrowAsJavaScriptException();
+      return env.Null();
+    }
+    for (uint32_t j = 0; j < targets.Length(); j++) {
+      Napi::Value value = targets.Get(j);
+      if (!value.IsTypedArray()) {
+        Napi::TypeError::New(env, "target arrays must be TypedArrays").ThrowAsJavaScriptException();
+        return env.Null();
+      }
+      Napi::TypedArray target = value.As<Napi::TypedArray>();
+      if (target.ElementLength() < len) {
+        Napi::TypeError::New(env, "target array cannot hold the result").ThrowAsJavaScriptException();
+        return env.Null();
+      }
+      symbolDesc<T> current;
+      current.type = target.TypedArrayType();
+      current.data = GetTypedArrayPtr<uint8_t>(target);
+      current.elementSize = target.ElementSize();
+      current.toCaster = NapiToCasters<T>[current.type];
+      outputs.push_back(current);
+    }
+    result = targets.Get(0u).As<Napi::TypedArray>();
+  } else if (info.Length() >= arg + 1 && info[arg].IsTypedArray()) {
     result = info[arg].As<Napi::TypedArray>();
     if (result.ElementLength() < len) {
       Napi::TypeError::New(env, "target array cannot hold the result").ThrowAsJavaScriptException();
@@ -891,10 +1256,11 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
   const NapiToCaster_t<T> toCaster = NapiToCasters<T>[outputType];
   if (outputType != NapiArrayType<T>::type) typeConversionRequired = true;
 
-  auto persistent = std::make_shared<Napi::Reference<Napi::TypedArray>>(Napi::Persistent(result));
+  auto persistent = std::make_shared<Napi::Reference<Napi::Object>>(
+    Napi::Persistent(targets.IsEmpty() ? result.As<Napi::Object>() : targets.As<Napi::Object>()));
 
-  // integer division ceiling
-  size_t lenPerJoblet = (len + job.joblets - 1) / job.joblets;
+  if (autoThreads) job.joblets = autoJoblets(len, async);
+  Partition partition(schedule, len, job.joblets, priority, &elementCost);
 
   std::shared_ptr<int32_t[]> rowMajorStride;
   if (ndarrays.size() > 0) {
@@ -905,28 +1271,33 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
       stride *= shape[d];
     }
   }
+  auto bytecode = program;
+  auto backend = this->backend;
   job.main = [scalars,
               vectors,
               ndarrays,
+              outputs,
               output,
               elementSize,
-              len,
               toCaster,
-              lenPerJoblet,
+              partition,
               dims,
               typeConversionRequired,
               shape,
-              rowMajorStride](const ExpressionInstance<T> &i, size_t id) {
+              rowMajorStride,
+              bytecode,
+              backend](const ExpressionInstance<T> &i, size_t id) {
     size_t scalarsNumber = scalars.size();
     size_t vectorsNumber = vectors.size();
     size_t ndArraysNumber = ndarrays.size();
 
-    symbolDesc<T> *localScalars = new symbolDesc<T>[scalarsNumber];
-    for (size_t j = 0; j < scalarsNumber; j++) localScalars[j] = scalars[j];
-    symbolDesc<T> *localVectors = new symbolDesc<T>[vectorsNumber];
-    for (size_t j = 0; j < vectorsNumber; j++) localVectors[j] = vectors[j];
-    symbolDesc<T> *localNDArrays = new symbolDesc<T>[ndArraysNumber];
-    for (size_t j = 0; j < ndArraysNumber; j++) localNDArrays[j] = ndarrays[j];
+    // These copies must be freed when a cancellation throws from the middle of the loops
+    std::vector<symbolDesc<T>> ownScalars(scalars);
+    std::vector<symbolDesc<T>> ownVectors(vectors);
+    std::vector<symbolDesc<T>> ownNDArrays(ndarrays);
+    symbolDesc<T> *localScalars = ownScalars.data();
+    symbolDesc<T> *localVectors = ownVectors.data();
+    symbolDesc<T> *localNDArrays = ownNDArrays.data();
 
     auto *localScalarsEnd = localScalars + scalarsNumber;
     auto *localVectorsEnd = localVectors + vectorsNumber;
@@ -938,98 +1309,151 @@ ASYNCABLE_DEFINE(template <typename T>, Expression<T>::cwise) {
     }
     for (auto *v = localVectors; v != localVectorsEnd; v++) {
       v->exprtk_var = &i.symbolTable.get_variable(v->name)->ref();
-      v->data = v->data + id * lenPerJoblet * v->elementSize;
     }
-
-    // Output is (for now) always positive-row-major
     for (auto *v = localNDArrays; v != localNDArraysEnd; v++) {
       v->exprtk_var = &i.symbolTable.get_variable(v->name)->ref();
       v->index = std::shared_ptr<size_t[]>(new size_t[dims]);
-      // Offset (linear index) is determined by the joblet id
-      v->offset = id * lenPerJoblet;
-      // Convert the offset to subscripts for a rowMajorStide
-      // to find the starting position
-      GetStridedIndex(v->offset, v->index, dims, shape, rowMajorStride);
-      // and then convert the subscripts to index for each ndarray separately
-      GetLinearOffset(v->offset, v->index, dims, shape, v->stride);
-
-      // Shortcut to allow iterating over the last dimension with a normal linear loop
-      v->data_ptr = v->data + v->offset * v->elementSize;
-      v->data_end = v->data_ptr + (shape[dims - 1] - v->index[dims - 1]) * v->stride[dims - 1] * v->elementSize;
     }
 
-    auto &expression = i.expression;
+    // Position all the arrays on the first element of a range
+    // Output is (for now) always positive-row-major
+    auto seek = [&](size_t start) {
+      for (size_t j = 0; j < vectorsNumber; j++)
+        localVectors[j].data = vectors[j].data + start * localVectors[j].elementSize;
+      for (auto *v = localNDArrays; v != localNDArraysEnd; v++) {
+        // Offset (linear index) is determined by the start of the range
+        v->offset = start;
+        // Convert the offset to subscripts for a rowMajorStide
+        // to find the starting position
+        GetStridedIndex(v->offset, v->index, dims, shape, rowMajorStride);
+        // and then convert the subscripts to index for each ndarray separately
+        GetLinearOffset(v->offset, v->index, dims, shape, v->stride);
+
+        // Shortcut to allow iterating over the last dimension with a normal linear loop
+        v->data_ptr = v->data + v->offset * v->elementSize;
+        v->data_end = v->data_ptr + (shape[dims - 1] - v->index[dims - 1]) * v->stride[dims - 1] * v->elementSize;
+      }
+    };
+
+    Evaluator<T> evaluate(backend, bytecode, i.expression, i.symbolTable);
+    vm::Polynomial<T> polynomial;
+    auto range = partition.range(id);
+    size_t start, end;
 
     // The time critical loops
-    if (typeConversionRequired && ndArraysNumber > 0) {
-      // The full loop
-      uint8_t *output_end = output + std::min((id + 1) * lenPerJoblet, len) * elementSize;
-      for (uint8_t *output_ptr = output + id * lenPerJoblet * elementSize; output_ptr < output_end;
-           output_ptr += elementSize) {
-        for (auto *v = localVectors; v != localVectorsEnd; v++) {
-          *v->exprtk_var = v->fromCaster(v->data);
-          v->data += v->elementSize;
+    if (!outputs.empty()) {
+      // Multiple return values, always evaluated by the tree, every input and output is converted
+      const size_t n = outputs.size();
+      std::unique_ptr<T[]> values(new T[n]);
+      while (range.next(start, end)) {
+        seek(start);
+        for (size_t k = start; k < end; k++) {
+          for (auto *v = localVectors; v != localVectorsEnd; v++) {
+            *v->exprtk_var = v->fromCaster(v->data);
+            v->data += v->elementSize;
+          }
+          for (auto *v = localNDArrays; v != localNDArraysEnd; v++) {
+            *v->exprtk_var = v->fromCaster(v->data_ptr);
+            v->data_ptr += v->smallestStride;
+            if (v->data_ptr == v->data_end) {
+              v->index[dims - 1] = shape[dims - 1] - 1;
+              IncrementStridedIndex(v->index, v->data, &v->data_ptr, v->elementSize, dims, shape, v->stride);
+              v->data_end =
+                v->data_ptr + (shape[dims - 1] - v->index[dims - 1]) * v->stride[dims - 1] * v->elementSize;
+            }
+          }
+          returnedValues(i.expression, i.expression.value(), values.get(), n);
+          for (size_t j = 0; j < n; j++) outputs[j].toCaster(outputs[j].data + k * outputs[j].elementSize, values[j]);
         }
-        for (auto *v = localNDArrays; v != localNDArraysEnd; v++) {
-          *v->exprtk_var = v->fromCaster(v->data_ptr);
-          v->data_ptr += v->smallestStride;
-          if (v->data_ptr == v->data_end) {
-            v->index[dims - 1] = shape[dims - 1] - 1;
-            IncrementStridedIndex(v->index, v->data, &v->data_ptr, v->elementSize, dims, shape, v->stride);
-            v->data_end = v->data_ptr + (shape[dims - 1] - v->index[dims - 1]) * v->stride[dims - 1] * v->elementSize;
+      }
+    } else if (
+      backend == Backend::Block && vectorsNumber == 1 && ndArraysNumber == 0 && !typeConversionRequired &&
+      polynomial.fit(*bytecode, i.symbolTable, localVectors->name)) {
+      // A polynomial of a single vector
+      const T *input = reinterpret_cast<const T *>(vectors[0].data);
+      while (range.next(start, end)) polynomial(input + start, reinterpret_cast<T *>(output) + start, end - start);
+    } else if (typeConversionRequired && ndArraysNumber > 0) {
+      // The full loop
+      while (range.next(start, end)) {
+        seek(start);
+        uint8_t *output_end = output + end * elementSize;
+        for (uint8_t *output_ptr = output + start * elementSize; output_ptr < output_end; output_ptr += elementSize) {
+          for (auto *v = localVectors; v != localVectorsEnd; v++) {
+            *v->exprtk_var = v->fromCaster(v->data);
+            v->data += v->elementSize;
+          }
+          for (auto *v = localNDArrays; v != localNDArraysEnd; v++) {
+            *v->exprtk_var = v->fromCaster(v->data_ptr);
+            v->data_ptr += v->smallestStride;
+            if (v->data_ptr == v->data_end) {
+              v->index[dims - 1] = shape[dims - 1] - 1;
+              IncrementStridedIndex(v->index, v->data, &v->data_ptr, v->elementSize, dims, shape, v->stride);
+              v->data_end =
+                v->data_ptr + (shape[dims - 1] - v->index[dims - 1]) * v->stride[dims - 1] * v->elementSize;
+            }
           }
+          evaluate(output_ptr, toCaster);
         }
-        toCaster(output_ptr, expression.value());
       }
+      evaluate.flush(toCaster);
     } else if (ndArraysNumber > 0) {
       // With ndarrays without type conversion
-      T *output_end = reinterpret_cast<T *>(output) + std::min((id + 1) * lenPerJoblet, len);
-      for (T *output_ptr = reinterpret_cast<T *>(output) + id * lenPerJoblet; output_ptr < output_end; output_ptr++) {
-        for (auto *v = localVectors; v != localVectorsEnd; v++) {
-          *v->exprtk_var = *(reinterpret_cast<T *>(v->data));
-          v->data += v->elementSize;
-        }
-        for (auto *v = localNDArrays; v != localNDArraysEnd; v++) {
-          *v->exprtk_var = *(reinterpret_cast<T *>(v->data_ptr));
-          v->data_ptr += v->smallestStride;
-          if (v->data_ptr == v->data_end) {
-            v->index[dims - 1] = shape[dims - 1] - 1;
-            IncrementStridedIndex(v->index, v->data, &v->data_ptr, v->elementSize, dims, shape, v->stride);
-            v->data_end = v->data_ptr + (shape[dims - 1] - v->index[dims - 1]) * v->stride[dims - 1] * v->elementSize;
+      while (range.next(start, end)) {
+        seek(start);
+        T *output_end = reinterpret_cast<T *>(output) + end;
+        for (T *output_ptr = reinterpret_cast<T *>(output) + start; output_ptr < output_end; output_ptr++) {
+          for (auto *v = localVectors; v != localVectorsEnd; v++) {
+            *v->exprtk_var = *(reinterpret_cast<T *>(v->data));
+            v->data += v->elementSize;
+          }
+          for (auto *v = localNDArrays; v != localNDArraysEnd; v++) {
+            *v->exprtk_var = *(reinterpret_cast<T *>(v->data_ptr));
+            v->data_ptr += v->smallestStride;
+            if (v->data_ptr == v->data_end) {
+              v->index[dims - 1] = shape[dims - 1] - 1;
+              IncrementStridedIndex(v->index, v->data, &v->data_ptr, v->elementSize, dims, shape, v->stride);
+              v->data_end =
+                v->data_ptr + (shape[dims - 1] - v->index[dims - 1]) * v->stride[dims - 1] * v->elementSize;
+            }
           }
+          evaluate(output_ptr);
         }
-        *output_ptr = expression.value();
       }
+      evaluate.flush();
     } else if (typeConversionRequired) {
       // Without ndarrays with type conversion
-      uint8_t *output_end = output + std::min((id + 1) * lenPerJoblet, len) * elementSize;
-      for (uint8_t *output_ptr = output + id * lenPerJoblet * elementSize; output_ptr < output_end;
-           output_ptr += elementSize) {
-        for (auto *v = localVectors; v != localVectorsEnd; v++) {
-          *v->exprtk_var = v->fromCaster(v->data);
-          v->data += v->elementSize;
+      while (range.next(start, end)) {
+        seek(start);
+        uint8_t *output_end = output + end * elementSize;
+        for (uint8_t *output_ptr = output + start * elementSize; output_ptr < output_end; output_ptr += elementSize) {
+          for (auto *v = localVectors; v != localVectorsEnd; v++) {
+            *v->exprtk_var = v->fromCaster(v->data);
+            v->data += v->elementSize;
+          }
+          evaluate(output_ptr, toCaster);
         }
-        toCaster(output_ptr, expression.value());
       }
+      evaluate.flush(toCaster);
     } else {
       // The fast simple loop
-      T *output_end = reinterpret_cast<T *>(output) + std::min((id + 1) * lenPerJoblet, len);
-      for (T *output_ptr = reinterpret_cast<T *>(output) + id * lenPerJoblet; output_ptr < output_end; output_ptr++) {
-        for (auto *v = localVectors; v != localVectorsEnd; v++) {
-          *v->exprtk_var = *(reinterpret_cast<T *>(v->data));
-          v->data += v->elementSize;
+      while (range.next(start, end)) {
+        seek(start);
+        T *output_end = reinterpret_cast<T *>(output) + end;
+        for (T *output_ptr = reinterpret_cast<T *>(output) + start; output_ptr < output_end; output_ptr++) {
+          for (auto *v = localVectors; v != localVectorsEnd; v++) {
+            *v->exprtk_var = *(reinterpret_cast<T *>(v->data));
+            v->data += v->elementSize;
+          }
+          evaluate(output_ptr);
         }
-        *output_ptr = expression.value();
       }
+      evaluate.flush();
     }
-    delete[] localScalars;
-    delete[] localVectors;
-    delete[] localNDArrays;
     return 0;
   };
 
   job.rval = [persistent](T r) { return persistent->Value(); };
-  return job.run(info, async, info.Length() - 1);
+  return job.run(info, async, callbackArg(info));
 }
 
 template <typename T>
@@ -1078,30 +1502,41 @@ Expression<T>::capi_cwise(const size_t n_args, const exprtk_capi_cwise_arg *args
   auto const toCaster = NapiToCasters<T>[result->type];
   if (static_cast<napi_typedarray_type>(result->type) != NapiArrayType<T>::type) typeConversionRequired = true;
 
+  vm::Polynomial<T> polynomial;
+  if (backend == Backend::Block && vectors.size() == 1 && !typeConversionRequired) {
+    for (auto const &v : scalars) { *v.exprtk_var = *(reinterpret_cast<const T *>(v.storage)); }
+    if (polynomial.fit(*program, instance()->symbolTable, vectors[0].name)) {
+      polynomial(reinterpret_cast<const T *>(vectors[0].data), reinterpret_cast<T *>(output), len);
+      return exprtk_ok;
+    }
+  }
+
   if (typeConversionRequired) {
     for (auto const &v : scalars) { *v.exprtk_var = *(reinterpret_cast<const T *>(v.storage)); }
 
-    auto &expression = instance()->expression;
+    Evaluator<T> evaluate(backend, program, instance()->expression, instance()->symbolTable);
     uint8_t *output_end = output + len * elementSize;
     for (uint8_t *output_ptr = output; output_ptr < output_end; output_ptr += elementSize) {
       for (auto &v : vectors) {
         *v.exprtk_var = v.fromCaster(v.data);
         v.data += v.elementSize;
       }
-      toCaster(output_ptr, expression.value());
+      evaluate(output_ptr, toCaster);
     }
+    evaluate.flush(toCaster);
   } else {
     for (auto const &v : scalars) { *v.exprtk_var = *(reinterpret_cast<const T *>(v.storage)); }
 
-    auto &expression = instance()->expression;
+    Evaluator<T> evaluate(backend, program, instance()->expression, instance()->symbolTable);
     T *output_end = reinterpret_cast<T *>(output) + len;
     for (T *output_ptr = reinterpret_cast<T *>(output); output_ptr < output_end; output_ptr++) {
       for (auto &v : vectors) {
         *v.exprtk_var = *(reinterpret_cast<T *>(v.data));
         v.data += v.elementSize;
       }
-      *output_ptr = expression.value();
+      evaluate(output_ptr);
     }
+    evaluate.flush();
   }
   return exprtk_ok;
 }
@@ -1183,7 +1618,7 @@ template <typename T> Napi::Value Expression<T>::GetScalars(const Napi::Callback
 
   size_t i = 0;
   for (const auto &name : variableNames) {
-    if (instances[0].symbolTable.get_variable(name)) { scalars.Set(i++, name); }
+    if (instances[0]->symbolTable.get_variable(name)) { scalars.Set(i++, name); }
   }
 
   return scalars;
@@ -1205,7 +1640,7 @@ template <typename T> Napi::Value Expression<T>::GetVectors(const Napi::Callback
   Napi::Object vectors = Napi::Object::New(env);
 
   for (const auto &name : variableNames) {
-    auto vector = instances[0].symbolTable.get_vector(name);
+    auto vector = instances[0]->symbolTable.get_vector(name);
     if (vector != nullptr) { vectors.Set(name, vector->size()); }
   }
 
@@ -1300,7 +1735,7 @@ template <typename T> Napi::Value Expression<T>::GetCAPI(const Napi::CallbackInf
 
   if (capiDescriptor != nullptr) return capiDescriptor->Value();
 
-  auto &symbolTable = instances[0].symbolTable;
+  auto &symbolTable = instances[0]->symbolTable;
   size_t size = sizeof(exprtk_expression) + symbolTable.variable_count() * sizeof(char *) +
     symbolTable.vector_count() * sizeof(exprtk_capi_vector);
 
@@ -1335,19 +1770,51 @@ template <typename T> Napi::Value Expression<T>::GetCAPI(const Napi::CallbackInf
 }
 
 /**
- * Get the number of threads available for evaluating expressions.
- * Set by the `EXPRTKJS_THREADS` environment variable.
+ * Get/set the number of threads available for evaluating expressions.
+ * Initially set by the `EXPRTKJS_THREADS` environment variable.
+ * The pool is shared by all Expressions (and all worker_threads), when it is shrunk
+ * the surplus threads exit after their current work.
+ * It affects only the default `maxParallel` of the Expressions created afterwards,
+ * existing Expressions can raise their own `maxParallel` up to the new value.
  *
- * @readonly
  * @kind member
  * @name maxParallel
  * @static
  * @memberof Expression
  * @type {number}
+ *
+ * @example
+ * // follow a new cgroup CPU quota
+ * Expression.maxParallel = 2;
  */
+template <typename T> Napi::Value Expression<T>::GetThreads(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::Number::New(env, asyncWorkers());
+}
+
+template <typename T> void Expression<T>::SetThreads(const Napi::CallbackInfo &info, const Napi::Value &value) {
+  Napi::Env env = info.Env();
+
+  if (value.IsEmpty() || !value.IsNumber()) {
+    Napi::TypeError::New(env, "value must be a number").ThrowAsJavaScriptException();
+    return;
+  }
+
+  size_t threads = value.ToNumber().Uint32Value();
+  if (threads < 1 || threads > maxAsyncWorkers()) {
+    Napi::TypeError::New(env, "the number of threads must be between 1 and " + std::to_string(maxAsyncWorkers()))
+      .ThrowAsJavaScriptException();
+    return;
+  }
+
+  resizeAsyncWorkers(threads);
+}
 
 /**
- * Get/set the maximum allowed parallel instances for this Expression
+ * Get/set the maximum allowed parallel instances for this Expression.
+ * Lowering it releases the surplus idle instances to the process-wide cache,
+ * instances are allocated and compiled again on demand when it is raised.
  *
  * @kind member
  * @name maxParallel
@@ -1370,15 +1837,22 @@ template <typename T> void Expression<T>::SetMaxParallel(const Napi::CallbackInf
   }
 
   size_t newMax = value.ToNumber().Uint32Value();
-  if (newMax > maxParallel) {
-    Napi::TypeError::New(
-      env,
-      "maximum instances is limited to the number of threads set by the environment variable EXPRTKJS_THREADS : " +
-        std::to_string(maxParallel))
+  size_t threads = asyncWorkers();
+  if (newMax < 1) {
+    size_t limit = std::max(threads, instances.size());
+    Napi::TypeError::New(env, "maxParallel must be between 1 and " + std::to_string(limit))
       .ThrowAsJavaScriptException();
     return;
   }
+  if (newMax > std::max(threads, instances.size())) {
+    Napi::TypeError::New(env, maxInstancesError(threads)).ThrowAsJavaScriptException();
+    return;
+  }
+  std::lock_guard<std::mutex> lock(asyncLock);
+  // The pool may have grown since this Expression was created
+  if (newMax > instances.size()) instances.resize(newMax);
   maxParallel = newMax;
+  trimIdleInstances();
 }
 
 /**
@@ -1394,7 +1868,418 @@ template <typename T> void Expression<T>::SetMaxParallel(const Napi::CallbackInf
 template <typename T> Napi::Value Expression<T>::GetMaxActive(const Napi::CallbackInfo &info) {
   Napi::Env env = info.Env();
 
-  return Napi::Number::New(env, maxActive);
+  return Napi::Number::New(env, maxActive.load());
+}
+
+/**
+ * Get the effective ExprTk parser settings of this Expression
+ *
+ * @readonly
+ * @kind member
+ * @name settings
+ * @instance
+ * @memberof Expression
+ * @type {Record<string, boolean>}
+ */
+template <typename T> Napi::Value Expression<T>::GetSettings(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  Napi::Object r = Napi::Object::New(env);
+  for (auto const &n : ParserSettings::names) r.Set(n.name, settings.enabled(n.flag));
+
+  return r;
+}
+
+/**
+ * Get the effective evaluation backend of `map()` and `cwise()`:
+ * `vm` or `block` if that backend was requested and the expression could be lowered to bytecode,
+ * `tree` otherwise
+ *
+ * @readonly
+ * @kind member
+ * @name backend
+ * @instance
+ * @memberof Expression
+ * @type {string}
+ */
+template <typename T> Napi::Value Expression<T>::GetBackend(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  switch (backend) {
+    case Backend::VM:
+      return Napi::String::New(env, "vm");
+    case Backend::Block:
+      return Napi::String::New(env, "block");
+    default:
+      return Napi::String::New(env, "tree");
+  }
+}
+
+/**
+ * Get/set the partitioning of the elements among the threads in multithreaded `map()` and `cwise()`,
+ * `static` (default) splits the array in equal slices, one per thread,
+ * `dynamic` lets the threads claim chunks of up to 4096 elements until there are none left -
+ * which is better when the cost per element varies, for example with loops or conditionals
+ * that depend on the input.
+ * The value is read when each call starts.
+ *
+ * @kind member
+ * @name schedule
+ * @instance
+ * @memberof Expression
+ * @type {string}
+ */
+template <typename T> Napi::Value Expression<T>::GetSchedule(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::String::New(env, schedule == Schedule::Dynamic ? "dynamic" : "static");
+}
+
+template <typename T> void Expression<T>::SetSchedule(const Napi::CallbackInfo &info, const Napi::Value &value) {
+  Napi::Env env = info.Env();
+
+  std::string name = !value.IsEmpty() && value.IsString() ? value.As<Napi::String>().Utf8Value() : "";
+  if (name == "static")
+    schedule = Schedule::Static;
+  else if (name == "dynamic")
+    schedule = Schedule::Dynamic;
+  else
+    Napi::TypeError::New(env, "schedule must be 'static' or 'dynamic'").ThrowAsJavaScriptException();
+}
+
+/**
+ * Get/set the priority class of the asynchronous and multithreaded evaluations of this Expression,
+ * `high`, `normal` (default) or `bulk`.
+ * The worker threads always run the pending work of the highest class first and
+ * a `bulk` `map()` or `cwise()` lets the pending `high` and `normal` work run
+ * between every two chunks of up to 4096 elements.
+ * The value is read when each call starts.
+ *
+ * @kind member
+ * @name priority
+ * @instance
+ * @memberof Expression
+ * @type {string}
+ *
+ * @example
+ * const interactive = new Expression('a * b', ['a', 'b'], undefined, { priority: 'high' });
+ * const batch = new Expression('sqrt(x)', ['x'], undefined, { priority: 'bulk' });
+ */
+template <typename T> Napi::Value Expression<T>::GetPriority(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  switch (priority) {
+    case Priority::High:
+      return Napi::String::New(env, "high");
+    case Priority::Bulk:
+      return Napi::String::New(env, "bulk");
+    default:
+      return Napi::String::New(env, "normal");
+  }
+}
+
+template <typename T> void Expression<T>::SetPriority(const Napi::CallbackInfo &info, const Napi::Value &value) {
+  Napi::Env env = info.Env();
+
+  std::string name = !value.IsEmpty() && value.IsString() ? value.As<Napi::String>().Utf8Value() : "";
+  if (name == "high")
+    priority = Priority::High;
+  else if (name == "normal")
+    priority = Priority::Normal;
+  else if (name == "bulk")
+    priority = Priority::Bulk;
+  else
+    Napi::TypeError::New(env, "priority must be 'high', 'normal' or 'bulk'").ThrowAsJavaScriptException();
+}
+
+/**
+ * Get the time spent waiting by the asynchronous and multithreaded evaluations of each priority class,
+ * from the start of the call until a worker thread starts running it.
+ * A multithreaded call counts once per thread.
+ * `totalWait` and `maxWait` are in milliseconds.
+ *
+ * @readonly
+ * @kind member
+ * @name queueStats
+ * @static
+ * @memberof Expression
+ * @type {Record<'high' | 'normal' | 'bulk', {count: number, totalWait: number, maxWait: number}>}
+ */
+template <typename T> Napi::Value Expression<T>::GetQueueStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  static const char *names[priorities] = {"high", "normal", "bulk"};
+  Napi::Object r = Napi::Object::New(env);
+  for (size_t c = 0; c < priorities; c++) {
+    auto stats = queueStats(static_cast<Priority>(c));
+    Napi::Object s = Napi::Object::New(env);
+    s.Set("count", stats.count);
+    s.Set("totalWait", stats.totalWait);
+    s.Set("maxWait", stats.maxWait);
+    r.Set(names[c], s);
+  }
+
+  return r;
+}
+
+/**
+ * Get/set the maximum number of pending - queued or running - asynchronous calls of this Expression,
+ * 0 (default) is unlimited.
+ * When it is reached, new asynchronous calls are rejected or wait depending on the `overflow` property.
+ * The synchronous calls are never limited.
+ *
+ * @kind member
+ * @name maxQueued
+ * @instance
+ * @memberof Expression
+ * @type {number}
+ */
+template <typename T> Napi::Value Expression<T>::GetMaxQueued(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::Number::New(env, maxQueued);
+}
+
+template <typename T> void Expression<T>::SetMaxQueued(const Napi::CallbackInfo &info, const Napi::Value &value) {
+  Napi::Env env = info.Env();
+
+  if (value.IsEmpty() || !value.IsNumber()) {
+    Napi::TypeError::New(env, "value must be a number").ThrowAsJavaScriptException();
+    return;
+  }
+
+  maxQueued = value.ToNumber().Uint32Value();
+  CompletionGate::notifyRoom();
+}
+
+/**
+ * Get/set what happens to an asynchronous call of this Expression when its own `maxQueued`
+ * or the process-wide `Expression.maxQueued` limit is reached.
+ * `reject` (default) fails the call immediately with an `Error` whose `code` is `EXPRTKJS_QUEUE_FULL`,
+ * `wait` holds it in the main thread, in the order of the calls of this Expression,
+ * until a pending call of any environment completes.
+ *
+ * @kind member
+ * @name overflow
+ * @instance
+ * @memberof Expression
+ * @type {string}
+ *
+ * @example
+ * const expr = new Expression('a * b', ['a', 'b'], undefined, { maxQueued: 64, overflow: 'reject' });
+ * try {
+ *   await expr.mapAsync(array, 'a', { b: 2 });
+ * } catch (e) {
+ *   if (e.code === 'EXPRTKJS_QUEUE_FULL') shedLoad();
+ * }
+ */
+template <typename T> Napi::Value Expression<T>::GetOverflow(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::String::New(env, overflow == Overflow::Wait ? "wait" : "reject");
+}
+
+template <typename T> void Expression<T>::SetOverflow(const Napi::CallbackInfo &info, const Napi::Value &value) {
+  Napi::Env env = info.Env();
+
+  std::string name = !value.IsEmpty() && value.IsString() ? value.As<Napi::String>().Utf8Value() : "";
+  if (name == "reject")
+    overflow = Overflow::Reject;
+  else if (name == "wait")
+    overflow = Overflow::Wait;
+  else
+    Napi::TypeError::New(env, "overflow must be 'reject' or 'wait'").ThrowAsJavaScriptException();
+}
+
+/**
+ * Get/set the maximum number of pending - queued or running - asynchronous calls in the process,
+ * 0 (default) is unlimited.
+ * Every pending call holds references to its arrays,
+ * limiting their number bounds the memory usage and the latency under load.
+ * Initially set by the `EXPRTKJS_MAX_QUEUED` environment variable.
+ *
+ * @kind member
+ * @name maxQueued
+ * @static
+ * @memberof Expression
+ * @type {number}
+ */
+template <typename T> Napi::Value Expression<T>::GetGlobalMaxQueued(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::Number::New(env, exprtk_js::maxQueued());
+}
+
+template <typename T>
+void Expression<T>::SetGlobalMaxQueued(const Napi::CallbackInfo &info, const Napi::Value &value) {
+  Napi::Env env = info.Env();
+
+  if (value.IsEmpty() || !value.IsNumber()) {
+    Napi::TypeError::New(env, "value must be a number").ThrowAsJavaScriptException();
+    return;
+  }
+
+  setMaxQueued(value.ToNumber().Uint32Value());
+}
+
+/**
+ * Get the admission counters of the asynchronous calls.
+ * `pending` is the number of currently queued or running calls,
+ * `queued` counts the accepted calls and `rejected` counts the calls
+ * that failed because a `maxQueued` limit was reached.
+ *
+ * @readonly
+ * @kind member
+ * @name admissionStats
+ * @static
+ * @memberof Expression
+ * @type {{pending: number, queued: number, rejected: number}}
+ */
+template <typename T> Napi::Value Expression<T>::GetAdmissionStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  auto stats = admissionStats();
+  Napi::Object r = Napi::Object::New(env);
+  r.Set("pending", stats.pending);
+  r.Set("queued", stats.queued);
+  r.Set("rejected", stats.rejected);
+
+  return r;
+}
+
+/**
+ * Get the state of the thread pool which is shared by the main thread
+ * and all the `worker_threads` that load ExprTk.js.
+ * `threads` is the number of worker threads, `envs` is the number
+ * of environments sharing them and `pending` is the number of
+ * asynchronous calls of the current environment that have not completed.
+ *
+ * @readonly
+ * @kind member
+ * @name poolStats
+ * @static
+ * @memberof Expression
+ * @type {{threads: number, envs: number, pending: number}}
+ */
+template <typename T> Napi::Value Expression<T>::GetPoolStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  Napi::Object r = Napi::Object::New(env);
+  r.Set("threads", asyncWorkers());
+  r.Set("envs", asyncWorkersUsers());
+  r.Set("pending", CompletionGate::pending(env));
+
+  return r;
+}
+
+/**
+ * Get the number of heap allocations performed by the addon since it was loaded.
+ * Available only when built with `--enable_alloc_count`, `undefined` otherwise.
+ *
+ * @readonly
+ * @kind member
+ * @name allocations
+ * @static
+ * @memberof Expression
+ * @type {number | undefined}
+ */
+template <typename T> Napi::Value Expression<T>::GetAllocations(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+#ifdef EXPRTKJS_COUNT_ALLOCATIONS
+  return Napi::Number::New(env, heapAllocations());
+#else
+  return env.Undefined();
+#endif
+}
+
+/**
+ * Get/set the pinning of the worker threads, each one to a single CPU.
+ * The CPUs are ordered by NUMA node and, when pinned, the slices of a multithreaded
+ * `map()` or `cwise()` with the static schedule are always assigned to the same threads -
+ * so that on multi-socket hosts each slice of the arrays is first-touched, and then read
+ * and written, by a thread on the same node.
+ * Initially set by the `EXPRTKJS_PIN_THREADS` environment variable, disabled by default.
+ * Supported only on Linux, ignored on the other platforms.
+ *
+ * @kind member
+ * @name pinThreads
+ * @static
+ * @memberof Expression
+ * @type {boolean}
+ */
+template <typename T> Napi::Value Expression<T>::GetPinThreads(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::Boolean::New(env, asyncWorkersPinned());
+}
+
+template <typename T> void Expression<T>::SetPinThreads(const Napi::CallbackInfo &info, const Napi::Value &value) {
+  Napi::Env env = info.Env();
+
+  if (value.IsEmpty() || !value.IsBoolean()) {
+    Napi::TypeError::New(env, "value must be a boolean").ThrowAsJavaScriptException();
+    return;
+  }
+
+  pinAsyncWorkers(value.ToBoolean().Value());
+}
+
+/**
+ * Get/set the maximum number of compiled instances kept in the process-wide cache.
+ * Idle instances of garbage-collected Expressions are reused by new Expressions
+ * with the same expression text, type, scalars and vectors instead of being recompiled.
+ * Set to 0 to disable the cache.
+ * Initially set by the `EXPRTKJS_CACHE_SIZE` environment variable.
+ *
+ * @kind member
+ * @name cacheSize
+ * @static
+ * @memberof Expression
+ * @type {number}
+ */
+template <typename T> Napi::Value Expression<T>::GetCacheSize(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  return Napi::Number::New(env, instanceCache().stats().maxSize);
+}
+
+template <typename T> void Expression<T>::SetCacheSize(const Napi::CallbackInfo &info, const Napi::Value &value) {
+  Napi::Env env = info.Env();
+
+  if (value.IsEmpty() || !value.IsNumber()) {
+    Napi::TypeError::New(env, "value must be a number").ThrowAsJavaScriptException();
+    return;
+  }
+
+  instanceCache().resize(value.ToNumber().Uint32Value());
+}
+
+/**
+ * Get the statistics of the process-wide cache of compiled instances.
+ * `size` is the number of currently cached instances, `hits` and `misses`
+ * count the compilations that were avoided or performed and `evictions`
+ * counts the instances that were discarded because the cache was full.
+ *
+ * @readonly
+ * @kind member
+ * @name cacheStats
+ * @static
+ * @memberof Expression
+ * @type {{size: number, maxSize: number, hits: number, misses: number, evictions: number}}
+ */
+template <typename T> Napi::Value Expression<T>::GetCacheStats(const Napi::CallbackInfo &info) {
+  Napi::Env env = info.Env();
+
+  auto stats = instanceCache().stats();
+  Napi::Object r = Napi::Object::New(env);
+  r.Set("size", stats.size);
+  r.Set("maxSize", stats.maxSize);
+  r.Set("hits", stats.hits);
+  r.Set("misses", stats.misses);
+  r.Set("evictions", stats.evictions);
+
+  return r;
 }
 
 /**
@@ -1412,7 +2297,6 @@ template <typename T> Napi::Value Expression<T>::ToString(const Napi::CallbackIn
 
 template <typename T> Napi::Function Expression<T>::GetClass(Napi::Env env) {
   const std::string className = std::string(NapiArrayType<T>::name) + "Expression";
-  const Napi::Value maxParallel = Napi::Number::New(env, ExpressionMaxParallel);
   const Napi::Symbol toStringTag = Napi::Symbol::WellKnown(env, "toStringTag");
   const Napi::String type = Napi::String::New(env, NapiArrayType<T>::name);
   return Expression<T>::DefineClass(
@@ -1427,7 +2311,29 @@ template <typename T> Napi::Function Expression<T>::GetClass(Napi::Env env) {
      Expression<T>::InstanceAccessor(
        "maxParallel", &Expression<T>::GetMaxParallel, &Expression<T>::SetMaxParallel, napi_enumerable),
      Expression<T>::InstanceAccessor("maxActive", &Expression<T>::GetMaxActive, nullptr, napi_enumerable),
-     Expression<T>::StaticValue("maxParallel", maxParallel, napi_enumerable),
+     Expression<T>::InstanceAccessor("settings", &Expression<T>::GetSettings, nullptr, napi_enumerable),
+     Expression<T>::InstanceAccessor("backend", &Expression<T>::GetBackend, nullptr, napi_enumerable),
+     Expression<T>::InstanceAccessor(
+       "schedule", &Expression<T>::GetSchedule, &Expression<T>::SetSchedule, napi_enumerable),
+     Expression<T>::InstanceAccessor(
+       "priority", &Expression<T>::GetPriority, &Expression<T>::SetPriority, napi_enumerable),
+     Expression<T>::InstanceAccessor(
+       "maxQueued", &Expression<T>::GetMaxQueued, &Expression<T>::SetMaxQueued, napi_enumerable),
+     Expression<T>::InstanceAccessor(
+       "overflow", &Expression<T>::GetOverflow, &Expression<T>::SetOverflow, napi_enumerable),
+     Expression<T>::StaticAccessor(
+       "maxParallel", &Expression<T>::GetThreads, &Expression<T>::SetThreads, napi_enumerable),
+     Expression<T>::StaticAccessor(
+       "pinThreads", &Expression<T>::GetPinThreads, &Expression<T>::SetPinThreads, napi_enumerable),
+     Expression<T>::StaticAccessor(
+       "cacheSize", &Expression<T>::GetCacheSize, &Expression<T>::SetCacheSize, napi_enumerable),
+     Expression<T>::StaticAccessor("cacheStats", &Expression<T>::GetCacheStats, nullptr, napi_enumerable),
+     Expression<T>::StaticAccessor("queueStats", &Expression<T>::GetQueueStats, nullptr, napi_enumerable),
+     Expression<T>::StaticAccessor(
+       "maxQueued", &Expression<T>::GetGlobalMaxQueued, &Expression<T>::SetGlobalMaxQueued, napi_enumerable),
+     Expression<T>::StaticAccessor("admissionStats", &Expression<T>::GetAdmissionStats, nullptr, napi_enumerable),
+     Expression<T>::StaticAccessor("poolStats", &Expression<T>::GetPoolStats, nullptr, napi_enumerable),
+     Expression<T>::StaticAccessor("allocations", &Expression<T>::GetAllocations, nullptr, napi_enumerable),
      Expression<T>::InstanceMethod(
        "toString", &Expression<T>::ToString, static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
      Expression<T>::InstanceAccessor(toStringTag, &Expression<T>::ToString, nullptr, napi_default),
@@ -1438,13 +2344,36 @@ template <typename T> Napi::Function Expression<T>::GetClass(Napi::Env env) {
      ASYNCABLE_INSTANCE_METHOD(
        Expression<T>, reduce, static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
      ASYNCABLE_INSTANCE_METHOD(
-       Expression<T>, cwise, static_cast<napi_property_attributes>(napi_writable | napi_configurable))});
+       Expression<T>, cwise, static_cast<napi_property_attributes>(napi_writable | napi_configurable)),
+     ASYNCABLE_INSTANCE_METHOD(
+       Expression<T>, prepare, static_cast<napi_property_attributes>(napi_writable | napi_configurable))});
+}
+
+// Used by the JS wrapper to retry the calls with `overflow: 'wait'`,
+// calls the listener once when a queue slot may have been freed in any env
+static void WaitForRoom(const Napi::CallbackInfo &info) {
+  if (info.Length() < 1 || !info[0].IsFunction()) {
+    Napi::TypeError::New(info.Env(), "listener must be a function").ThrowAsJavaScriptException();
+    return;
+  }
+  CompletionGate::waitForRoom(info.Env(), info[0].As<Napi::Function>());
 }
 
 Napi::Object Init(Napi::Env env, Napi::Object exports) {
-  const char *exprtkjs_threads = std::getenv("EXPRTKJS_THREADS");
-  if (exprtkjs_threads != nullptr) ExpressionMaxParallel = std::stoi(exprtkjs_threads);
-  initAsyncWorkers(ExpressionMaxParallel);
+  // The first environment starts the pool and applies the process-wide settings,
+  // the others only share it
+  acquireAsyncWorkers([](size_t &threads, bool &pin) {
+    const char *exprtkjs_threads = std::getenv("EXPRTKJS_THREADS");
+    if (exprtkjs_threads != nullptr) threads = std::stoi(exprtkjs_threads);
+    const char *exprtkjs_cache_size = std::getenv("EXPRTKJS_CACHE_SIZE");
+    if (exprtkjs_cache_size != nullptr) ExpressionCacheSize = std::stoi(exprtkjs_cache_size);
+    const char *exprtkjs_pin_threads = std::getenv("EXPRTKJS_PIN_THREADS");
+    if (exprtkjs_pin_threads != nullptr) pin = std::stoi(exprtkjs_pin_threads) != 0;
+    const char *exprtkjs_max_queued = std::getenv("EXPRTKJS_MAX_QUEUED");
+    if (exprtkjs_max_queued != nullptr) setMaxQueued(std::stoi(exprtkjs_max_queued));
+    initInstanceCache(ExpressionCacheSize);
+  });
+  napi_add_env_cleanup_hook(env, [](void *) { releaseAsyncWorkers(); }, nullptr);
 #ifndef EXPRTK_DISABLE_INT_TYPES
   exports.Set(Napi::String::New(env, NapiArrayType<int8_t>::name), Expression<int8_t>::GetClass(env));
   exports.Set(Napi::String::New(env, NapiArrayType<uint8_t>::name), Expression<uint8_t>::GetClass(env));
@@ -1455,6 +2384,7 @@ Napi::Object Init(Napi::Env env, Napi::Object exports) {
 #endif
   exports.Set(Napi::String::New(env, NapiArrayType<float>::name), Expression<float>::GetClass(env));
   exports.Set(Napi::String::New(env, NapiArrayType<double>::name), Expression<double>::GetClass(env));
+  exports.Set(Napi::String::New(env, "waitForRoom"), Napi::Function::New(env, WaitForRoom));
   return exports;
 }
 
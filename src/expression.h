@@ -5,6 +5,7 @@
 #include <mutex>
 #include <condition_variable>
 #include <functional>
+#include <limits>
 #include <list>
 #include <queue>
 #include <napi.h>
@@ -12,11 +13,42 @@
 #include <exprtkjs.h>
 
 #include "async.h"
+#include "cache.h"
+#include "parser.h"
 #include "types.h"
 #include "ndarray.h"
+#include "poly.h"
+#include "vm.h"
 
 namespace exprtk_js {
 
+// Stops the ExprTk loops of an instance when its job is cancelled
+// The loops compare their iteration count to the atomic `max_loop_iterations`
+// (patched ExprTk) at every iteration, lowering it to 0 from another
+// thread makes them call handle_runtime_violation at the next one
+class LoopInterrupt : public exprtk::loop_runtime_check, public Interruptible {
+    public:
+  LoopInterrupt() {
+    loop_set = e_all_loops;
+    max_loop_iterations = unlimited;
+  }
+
+  virtual void interrupt() {
+    max_loop_iterations.store(0, std::memory_order_relaxed);
+  }
+
+  virtual void resume() {
+    max_loop_iterations.store(unlimited, std::memory_order_relaxed);
+  }
+
+  virtual void handle_runtime_violation(const violation_context &) {
+    throw abortedError;
+  }
+
+    private:
+  static constexpr exprtk::details::_uint64_t unlimited = std::numeric_limits<exprtk::details::_uint64_t>::max();
+};
+
 template <class T> struct ExpressionInstance {
   exprtk::symbol_table<T> symbolTable;
   exprtk::expression<T> expression;
@@ -24,6 +56,21 @@ template <class T> struct ExpressionInstance {
   // These are the vectorViews needed for rebasing the vectors when evaluating
   // Read "SECTION 14" of the ExprTk manual for more information on this
   std::map<std::string, std::unique_ptr<exprtk::vector_view<T>>> vectorViews;
+  // Registered with the parser when compiling, the compiled loops keep a pointer to it
+  std::unique_ptr<LoopInterrupt> loopInterrupt;
+
+  ExpressionInstance() : isInit(false), loopInterrupt(new LoopInterrupt) {
+  }
+  ExpressionInstance(ExpressionInstance &&) = default;
+  ExpressionInstance &operator=(ExpressionInstance &&) = default;
+
+  ~ExpressionInstance() {
+    for (auto const &v : vectorViews) {
+      // exprtk will sometimes try to free this pointer
+      // on object destruction even if it never allocated it
+      v.second->rebase((T *)nullptr);
+    }
+  }
 };
 
 template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>> {
@@ -36,6 +83,7 @@ template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>>
   ASYNCABLE_DECLARE(map);
   ASYNCABLE_DECLARE(reduce);
   ASYNCABLE_DECLARE(cwise);
+  ASYNCABLE_DECLARE(prepare);
 
   Napi::Value ToString(const Napi::CallbackInfo &info);
 
@@ -64,36 +112,70 @@ template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>>
   Napi::Value GetMaxParallel(const Napi::CallbackInfo &info);
   void SetMaxParallel(const Napi::CallbackInfo &info, const Napi::Value &value);
   Napi::Value GetMaxActive(const Napi::CallbackInfo &info);
+  Napi::Value GetSettings(const Napi::CallbackInfo &info);
+  Napi::Value GetBackend(const Napi::CallbackInfo &info);
+  Napi::Value GetSchedule(const Napi::CallbackInfo &info);
+  void SetSchedule(const Napi::CallbackInfo &info, const Napi::Value &value);
+  Napi::Value GetPriority(const Napi::CallbackInfo &info);
+  void SetPriority(const Napi::CallbackInfo &info, const Napi::Value &value);
+  static Napi::Value GetThreads(const Napi::CallbackInfo &info);
+  static void SetThreads(const Napi::CallbackInfo &info, const Napi::Value &value);
+  static Napi::Value GetPinThreads(const Napi::CallbackInfo &info);
+  static void SetPinThreads(const Napi::CallbackInfo &info, const Napi::Value &value);
+  static Napi::Value GetCacheSize(const Napi::CallbackInfo &info);
+  static void SetCacheSize(const Napi::CallbackInfo &info, const Napi::Value &value);
+  static Napi::Value GetCacheStats(const Napi::CallbackInfo &info);
+  static Napi::Value GetQueueStats(const Napi::CallbackInfo &info);
+  Napi::Value GetMaxQueued(const Napi::CallbackInfo &info);
+  void SetMaxQueued(const Napi::CallbackInfo &info, const Napi::Value &value);
+  Napi::Value GetOverflow(const Napi::CallbackInfo &info);
+  void SetOverflow(const Napi::CallbackInfo &info, const Napi::Value &value);
+  static Napi::Value GetGlobalMaxQueued(const Napi::CallbackInfo &info);
+  static void SetGlobalMaxQueued(const Napi::CallbackInfo &info, const Napi::Value &value);
+  static Napi::Value GetAdmissionStats(const Napi::CallbackInfo &info);
+  static Napi::Value GetPoolStats(const Napi::CallbackInfo &info);
+  static Napi::Value GetAllocations(const Napi::CallbackInfo &info);
 
   static Napi::Function GetClass(Napi::Env);
 
     private:
-  // This is the evaluations that are waiting for an evaluation instance
-  std::queue<Joblet<T> *> work_queue;
+  // This is the evaluations that are waiting for an evaluation instance, by priority class
+  std::queue<Joblet<T> *> work_queue[priorities];
   // This is where synchronous evaluation sleep while waiting for an instance
   std::condition_variable work_condition;
 
   std::string expressionText;
+  // The signature of this Expression in the process-wide instance cache
+  std::string cacheKey;
+  ParserSettings settings;
+  // The bytecode of this Expression when using the VM or the block backends
+  std::shared_ptr<const vm::Program<T>> program;
+  Backend backend;
+  // The partitioning of the elements of map() and cwise() among the threads
+  Schedule schedule;
+  // The priority class of the joblets of the next calls
+  Priority priority;
+  // The measured time to evaluate one element in map() and cwise()
+  ElementCost elementCost;
+  // The limit of pending asynchronous calls of this Expression, 0 is unlimited
+  std::atomic_size_t maxQueued;
+  std::atomic_size_t pendingJobs;
+  Overflow overflow;
 
   size_t maxParallel;
-  size_t maxActive;
+  std::atomic_size_t maxActive;
   size_t currentActive;
 
   std::mutex asyncLock;
 
   // ExprTk stuff in multiple instances to support reentrancy
-  std::vector<ExpressionInstance<T>> instances;
+  // An empty instance is not free (its symbol table alone is several KB)
+  // so instances are allocated on first use and the surplus is released
+  // when maxParallel is lowered
+  std::vector<std::unique_ptr<ExpressionInstance<T>>> instances;
+  size_t instancesAllocated;
   std::list<ExpressionInstance<T> *> instancesIdle;
 
-  // this one is prone to static initialization fiasco
-  // there is a single shared instance per data type
-  inline exprtk::parser<T> &parser() {
-    static exprtk::parser<T> _parser;
-
-    return _parser;
-  }
-  std::mutex parserMutex;
-
   // get_variable_list / get_vector_list do not conserve the initial order
   std::vector<std::string> variableNames;
 
@@ -102,6 +184,9 @@ template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>>
 
   // Helpers
 
+  // Compile up to n instances in the worker threads
+  Napi::Value runPrepare(const Napi::CallbackInfo &info, size_t n, bool async);
+
   // Check a user supplied argument and return a function that imports it into the symbol table
   // Actual importing is deferred to right before the evaluation which might be waiting on an async lock
   void importValue(
@@ -111,7 +196,7 @@ template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>>
     const Napi::Value &value,
     std::vector<std::function<void(const ExpressionInstance<T> &)>> &importers) const {
     if (value.IsTypedArray()) {
-      if (instances[0].vectorViews.count(name) == 0) {
+      if (instances[0]->vectorViews.count(name) == 0) {
         throw Napi::TypeError::New(env, name + " is not a declared vector variable");
       }
       if (value.As<Napi::TypedArray>().TypedArrayType() != NapiArrayType<T>::type) {
@@ -119,11 +204,11 @@ template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>>
       }
       Napi::TypedArray data = value.As<Napi::TypedArray>();
 
-      if (instances[0].vectorViews.at(name)->size() != data.ElementLength()) {
+      if (instances[0]->vectorViews.at(name)->size() != data.ElementLength()) {
         throw Napi::TypeError::New(
           env,
           "vector " + name + " size " + std::to_string(data.ElementLength()) + " does not match declared size " +
-            std::to_string(instances[0].vectorViews.at(name)->size()));
+            std::to_string(instances[0]->vectorViews.at(name)->size()));
       }
 
       T *raw = reinterpret_cast<T *>(data.ArrayBuffer().Data());
@@ -133,7 +218,7 @@ template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>>
     }
 
     if (value.IsNumber()) {
-      auto v = instances[0].symbolTable.get_variable(name);
+      auto v = instances[0]->symbolTable.get_variable(name);
       if (v == nullptr) { throw Napi::TypeError::New(env, name + " is not a declared scalar variable"); }
       T raw = NapiArrayType<T>::CastFrom(value);
       importers.push_back([raw, name](const ExpressionInstance<T> &i) {
@@ -180,27 +265,175 @@ template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>>
     }
   }
 
+  // Retrieve the values of an explicit `return [a, b, ...]`,
+  // an expression without a return statement has only one value
+  static inline void returnedValues(const exprtk::expression<T> &expression, T value, T *values, size_t n) {
+    auto const &returned = expression.results();
+    if (returned.count() == 0 && n == 1) {
+      values[0] = value;
+      return;
+    }
+    if (returned.count() != n) throw "the number of returned values does not match the number of target arrays";
+    for (size_t j = 0; j < n; j++) {
+      if (returned[j].type != exprtk::type_store<T>::e_scalar) throw "only scalar values can be returned";
+      values[j] = typename exprtk::type_store<T>::scalar_view(returned[j])();
+    }
+  }
+
     public:
+  inline Priority jobPriority() const {
+    return priority;
+  }
+
+  // Reserve a slot for a new asynchronous call in this Expression
+  // and in the process, returns nullptr or the reason for turning it away
+  inline const char *admitJob() {
+    const char *err = nullptr;
+    size_t limit = maxQueued;
+    size_t pending = pendingJobs;
+    do {
+      if (limit != 0 && pending >= limit) {
+        err = "too many pending asynchronous calls of this Expression, the limit is set by maxQueued";
+        break;
+      }
+    } while (!pendingJobs.compare_exchange_weak(pending, pending + 1));
+    if (err == nullptr && !admitAsyncJob()) {
+      pendingJobs--;
+      err = "too many pending asynchronous calls, the limit is set by Expression.maxQueued";
+    }
+    // A waiting call is retried, it is counted only once it is accepted
+    if (err != nullptr && overflow == Overflow::Reject) rejectAsyncJob();
+    return err;
+  }
+
+  inline void releaseJob() {
+    pendingJobs--;
+    releaseAsyncJob();
+  }
+
+  // The cost model of `threads: 'auto'`, the elements are assumed to cost
+  // `defaultElementCost` ns until the first calls have been measured
+  // by the partitions of map() and cwise()
+  static constexpr double defaultElementCost = 10;
+
+  // The number of joblets that minimizes the expected time of a call on `len` elements,
+  // each additional joblet divides the work but has to go through the scheduler
+  inline size_t autoJoblets(size_t len, bool async) {
+    double cost = elementCost.get();
+    if (cost == 0) cost = defaultElementCost;
+    const double work = cost * len;
+    // A synchronous call runs one of its joblets in the main thread
+    const size_t limit = std::min(maxParallel, asyncWorkers() + (async ? 0 : 1));
+    if (limit < 2) return 1;
+
+    const DispatchCost dispatch = dispatchCost();
+    const size_t dispatched = async ? 1 : 2;
+    // A synchronous call with a single joblet runs directly in the main thread
+    size_t best = 1;
+    double bestTime = async ? work + dispatch.roundTrip : work;
+    for (size_t k = 2; k <= limit; k++) {
+      double time = work / k + dispatch.roundTrip + dispatch.perJoblet * (k - dispatched);
+      if (time < bestTime) {
+        best = k;
+        bestTime = time;
+      }
+    }
+    return best;
+  }
+
   inline void enqueue(Joblet<T> *w) {
     std::lock_guard<std::mutex> lock(asyncLock);
-    work_queue.push(w);
+    work_queue[static_cast<size_t>(w->priority)].push(w);
   }
 
   inline Joblet<T> *dequeue() {
     std::lock_guard<std::mutex> lock(asyncLock);
-    if (work_queue.empty()) return nullptr;
-    auto *w = work_queue.front();
-    work_queue.pop();
-    return w;
+    for (auto &queue : work_queue) {
+      if (queue.empty()) continue;
+      auto *w = queue.front();
+      queue.pop();
+      return w;
+    }
+    return nullptr;
   }
 
-  inline ExpressionInstance<T> *getIdleInstance() {
-    std::lock_guard<std::mutex> lock(asyncLock);
-    if (instancesIdle.empty() || currentActive >= maxParallel) return nullptr;
+  // All the following must be called with asyncLock held
+  inline bool hasIdleInstance() const {
+    return (!instancesIdle.empty() || instancesAllocated < instances.size()) && currentActive < maxParallel;
+  }
+
+  inline ExpressionInstance<T> *allocateInstance() {
+    for (auto &slot : instances) {
+      if (slot == nullptr) {
+        slot.reset(new ExpressionInstance<T>);
+        instancesAllocated++;
+        return slot.get();
+      }
+    }
+    return nullptr;
+  }
+
+  inline ExpressionInstance<T> *popIdleInstance() {
+    currentActive++;
+    if (instancesIdle.empty()) return allocateInstance();
     auto *r = instancesIdle.front();
     instancesIdle.pop_front();
-    currentActive++;
-    if (!r->isInit) compileInstance(r);
+    return r;
+  }
+
+  // Give the surplus idle instances to the process-wide cache,
+  // the first one is never released as it holds the reference symbol table
+  inline void trimIdleInstances() {
+    for (auto it = instancesIdle.begin(); it != instancesIdle.end() && instancesAllocated > maxParallel;) {
+      ExpressionInstance<T> *i = *it;
+      if (i == instances[0].get()) {
+        it++;
+        continue;
+      }
+      it = instancesIdle.erase(it);
+      if (i->isInit) instanceCache().release(cacheKey, *i);
+      for (auto &slot : instances) {
+        if (slot.get() == i) {
+          slot.reset();
+          break;
+        }
+      }
+      instancesAllocated--;
+    }
+  }
+
+  inline ExpressionInstance<T> *getIdleInstance() {
+    std::unique_lock<std::mutex> lock(asyncLock);
+    if (!hasIdleInstance()) return nullptr;
+    // Compiling is left to the worker thread
+    return popIdleInstance();
+  }
+
+  // Reserve idle instances that have not been compiled yet
+  // so that the total number of compiled instances reaches `n`,
+  // no more than `maxParallel` instances are ever active or allocated
+  inline std::vector<ExpressionInstance<T> *> reserveUncompiledInstances(size_t n) {
+    std::lock_guard<std::mutex> lock(asyncLock);
+    std::vector<ExpressionInstance<T> *> r;
+    // Only the idle instances can be safely inspected,
+    // the active ones are either compiled or being compiled
+    size_t compiled = instancesAllocated;
+    for (auto const *i : instancesIdle)
+      if (!i->isInit) compiled--;
+    for (auto it = instancesIdle.begin();
+         it != instancesIdle.end() && compiled + r.size() < n && currentActive < maxParallel;) {
+      if ((*it)->isInit) {
+        it++;
+        continue;
+      }
+      r.push_back(*it);
+      it = instancesIdle.erase(it);
+      currentActive++;
+    }
+    while (compiled + r.size() < n && currentActive < maxParallel && instancesAllocated < maxParallel) {
+      r.push_back(allocateInstance());
+      currentActive++;
+    }
     return r;
   }
 
@@ -208,16 +441,16 @@ template <typename T> class Expression : public Napi::ObjectWrap<Expression<T>>
     std::unique_lock<std::mutex> lock(asyncLock);
     instancesIdle.push_front(i);
     currentActive--;
+    if (instancesAllocated > maxParallel) trimIdleInstances();
     lock.unlock();
     work_condition.notify_one();
   }
 
   inline ExpressionInstance<T> *waitIdleInstance() {
     std::unique_lock<std::mutex> lock(asyncLock);
-    work_condition.wait(lock, [this] { return !instancesIdle.empty() && currentActive < maxParallel; });
-    auto *r = instancesIdle.front();
-    instancesIdle.pop_front();
-    currentActive++;
+    work_condition.wait(lock, [this] { return hasIdleInstance(); });
+    auto *r = popIdleInstance();
+    lock.unlock();
     if (!r->isInit) compileInstance(r);
     return r;
   }
@@ -245,4 +478,30 @@ template <typename T> class InstanceGuard {
   ExpressionInstance<T> *instance;
 };
 
+// A RAII guard for the admission slot of an asynchronous call
+// which is released unless the call is started
+template <typename T> class AdmissionGuard {
+    public:
+  inline AdmissionGuard(Expression<T> *e) : expression(e), error(e->admitJob()), committed(false) {
+  }
+
+  inline ~AdmissionGuard() {
+    if (error == nullptr && !committed) expression->releaseJob();
+  }
+
+  // The reason the call was turned away or nullptr
+  inline const char *Error() const {
+    return error;
+  }
+
+  inline void Commit() {
+    committed = true;
+  }
+
+    private:
+  Expression<T> *expression;
+  const char *error;
+  bool committed;
+};
+
 }; // namespace exprtk_js
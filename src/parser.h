@@ -0,0 +1,138 @@
+#pragma once
+
+#include <exprtk.hpp>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace exprtk_js {
+
+// The subset of the ExprTk parser settings that can be changed from JS,
+// everything is enabled by default as in ExprTk
+struct ParserSettings {
+  enum Flag : uint32_t {
+    replacer = 1 << 0,
+    joiner = 1 << 1,
+    numericCheck = 1 << 2,
+    bracketCheck = 1 << 3,
+    sequenceCheck = 1 << 4,
+    commutativeCheck = 1 << 5,
+    strengthReduction = 1 << 6,
+    localVariables = 1 << 7,
+    controlStructures = 1 << 8,
+    loops = 1 << 9,
+    assignments = 1 << 10,
+    all = (1 << 11) - 1
+  };
+
+  struct Name {
+    const char *name;
+    Flag flag;
+  };
+  static constexpr Name names[] = {
+    {"replacer", replacer},
+    {"joiner", joiner},
+    {"numericCheck", numericCheck},
+    {"bracketCheck", bracketCheck},
+    {"sequenceCheck", sequenceCheck},
+    {"commutativeCheck", commutativeCheck},
+    {"strengthReduction", strengthReduction},
+    {"localVariables", localVariables},
+    {"controlStructures", controlStructures},
+    {"loops", loops},
+    {"assignments", assignments}};
+
+  uint32_t flags;
+
+  ParserSettings() : flags(all) {
+  }
+
+  inline bool enabled(Flag f) const {
+    return (flags & f) != 0;
+  }
+
+  inline void set(Flag f, bool enable) {
+    flags = enable ? flags | f : flags & ~f;
+  }
+
+  template <typename T> typename exprtk::parser<T>::settings_t store() const {
+    typedef typename exprtk::parser<T>::settings_t settings_t;
+    std::size_t options = 0;
+    if (enabled(replacer)) options |= settings_t::e_replacer;
+    if (enabled(joiner)) options |= settings_t::e_joiner;
+    if (enabled(numericCheck)) options |= settings_t::e_numeric_check;
+    if (enabled(bracketCheck)) options |= settings_t::e_bracket_check;
+    if (enabled(sequenceCheck)) options |= settings_t::e_sequence_check;
+    if (enabled(commutativeCheck)) options |= settings_t::e_commutative_check;
+    if (enabled(strengthReduction)) options |= settings_t::e_strength_reduction;
+    if (!enabled(localVariables)) options |= settings_t::e_disable_vardef;
+
+    settings_t r(options);
+    if (!enabled(controlStructures)) r.disable_all_control_structures();
+    if (!enabled(loops)) {
+      r.disable_control_structure(settings_t::e_ctrl_for_loop);
+      r.disable_control_structure(settings_t::e_ctrl_while_loop);
+      r.disable_control_structure(settings_t::e_ctrl_repeat_loop);
+    }
+    if (!enabled(assignments)) r.disable_all_assignment_ops();
+    return r;
+  }
+};
+
+// ExprTk parsers are not reentrant and are expensive to construct
+// There is a shared pool of parsers per data type and settings that grows
+// on demand up to the number of simultaneous compilations
+template <typename T> class ParserPool {
+    public:
+  // this one is prone to static initialization fiasco
+  static inline ParserPool<T> &get() {
+    static ParserPool<T> *pool = new ParserPool<T>;
+    return *pool;
+  }
+
+  inline std::unique_ptr<exprtk::parser<T>> acquire(const ParserSettings &settings) {
+    std::unique_lock<std::mutex> guard(lock);
+    auto &pool = idle[settings.flags];
+    if (pool.empty()) {
+      guard.unlock();
+      return std::unique_ptr<exprtk::parser<T>>(new exprtk::parser<T>(settings.store<T>()));
+    }
+    auto p = std::move(pool.back());
+    pool.pop_back();
+    return p;
+  }
+
+  inline void release(const ParserSettings &settings, std::unique_ptr<exprtk::parser<T>> p) {
+    std::lock_guard<std::mutex> guard(lock);
+    idle[settings.flags].push_back(std::move(p));
+  }
+
+    private:
+  std::mutex lock;
+  std::map<uint32_t, std::vector<std::unique_ptr<exprtk::parser<T>>>> idle;
+};
+
+// A RAII guard for borrowing a parser from the pool
+template <typename T> class ParserGuard {
+    public:
+  inline ParserGuard(const ParserSettings &settings)
+    : settings(settings), parser(ParserPool<T>::get().acquire(settings)) {
+  }
+
+  inline ~ParserGuard() {
+    ParserPool<T>::get().release(settings, std::move(parser));
+  }
+
+  inline exprtk::parser<T> *operator->() const {
+    return parser.get();
+  }
+
+    private:
+  ParserSettings settings;
+  std::unique_ptr<exprtk::parser<T>> parser;
+};
+
+} // namespace exprtk_js
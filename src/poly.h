@@ -0,0 +1,272 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+#include "vm.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#ifdef __SSE2__
+#define EXPRTK_JS_SSE2
+#endif
+#define EXPRTK_JS_AVX2_DISPATCH
+#elif defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define EXPRTK_JS_SSE2
+#endif
+
+namespace exprtk_js {
+namespace vm {
+
+/**
+ * A fast path for the most common formula: a polynomial of the iterated variable
+ *
+ * The program is expanded symbolically, the other variables being constant
+ * for the whole evaluation, and if the result is a polynomial, the elements are
+ * evaluated with a Horner scheme by SIMD kernels selected at runtime.
+ *
+ * The integer results are identical to the tree. Floating point values are
+ * evaluated in a different order and are rounded differently, the difference
+ * being the largest near the roots where the terms cancel each other.
+ */
+template <typename T> class Polynomial {
+    public:
+  static constexpr size_t maxDegree = 16;
+  typedef void (*kernel_t)(const T *, size_t, const T *, T *, size_t);
+
+  size_t degree;
+  // coefficients[k] is the coefficient of x^k
+  T coefficients[maxDegree + 1];
+
+  // Expand the program for the current values of the variables,
+  // returns false if it is not a polynomial of the iterator
+  bool fit(const Program<T> &program, const exprtk::symbol_table<T> &symbolTable, const std::string &iterator) {
+    std::vector<Polynomial<T>> r(program.registers.size());
+    for (size_t j = 0; j < r.size(); j++) r[j].set(program.registers[j]);
+    for (size_t j = 0; j < program.variables.size(); j++) {
+      if (program.variables[j] == iterator) {
+        r[j].set(T(0));
+        r[j].degree = 1;
+        r[j].coefficients[1] = T(1);
+      } else {
+        r[j].set(symbolTable.get_variable(program.variables[j])->ref());
+      }
+    }
+
+    for (auto const &i : program.code) {
+      Polynomial<T> &d = r[i.dst];
+      const Polynomial<T> &a = r[i.a];
+      switch (i.op) {
+        case Add:
+          d.sum(a, r[i.b], T(1));
+          break;
+        case Sub:
+          d.sum(a, r[i.b], T(-1));
+          break;
+        case Mul:
+          if (!d.product(a, r[i.b])) return false;
+          break;
+        case Neg:
+          d = a;
+          for (size_t k = 0; k <= d.degree; k++) d.coefficients[k] = static_cast<T>(-a.coefficients[k]);
+          break;
+        case Div:
+          // integer division is not distributive
+          if (std::is_integral<T>::value || r[i.b].degree > 0) return false;
+          d = a;
+          for (size_t k = 0; k <= d.degree; k++) d.coefficients[k] = a.coefficients[k] / r[i.b].coefficients[0];
+          break;
+        case Call: {
+          // only the integer powers
+          if (i.c == 0 || a.degree * i.c > maxDegree) return false;
+          d = a;
+          for (uint32_t n = 1; n < i.c; n++) d.product(d, a);
+          break;
+        }
+        default:
+          return false;
+      }
+    }
+    *this = r[program.result];
+    return true;
+  }
+
+  inline void operator()(const T *input, T *output, size_t n) const {
+    static const kernel_t kernel = select();
+    kernel(coefficients, degree, input, output, n);
+  }
+
+    private:
+  inline void set(const T v) {
+    degree = 0;
+    coefficients[0] = v;
+  }
+
+  inline T at(size_t k) const {
+    return k <= degree ? coefficients[k] : T(0);
+  }
+
+  inline void sum(const Polynomial<T> &a, const Polynomial<T> &b, const T sign) {
+    const size_t n = std::max(a.degree, b.degree);
+    T c[maxDegree + 1];
+    for (size_t k = 0; k <= n; k++) c[k] = static_cast<T>(a.at(k) + sign * b.at(k));
+    degree = n;
+    std::copy(c, c + n + 1, coefficients);
+  }
+
+  inline bool product(const Polynomial<T> &a, const Polynomial<T> &b) {
+    const size_t n = a.degree + b.degree;
+    if (n > maxDegree) return false;
+    T c[maxDegree + 1];
+    std::fill(c, c + n + 1, T(0));
+    for (size_t j = 0; j <= a.degree; j++)
+      for (size_t k = 0; k <= b.degree; k++) c[j + k] = static_cast<T>(c[j + k] + a.coefficients[j] * b.coefficients[k]);
+    degree = n;
+    std::copy(c, c + n + 1, coefficients);
+    return true;
+  }
+
+  // The portable kernel, the compiler vectorizes the inner loops
+  // (a block at a time so that the input can also be the output)
+  static void horner(const T *c, size_t degree, const T *input, T *output, size_t n) {
+    T block[256];
+    for (size_t start = 0; start < n; start += 256) {
+      const size_t len = std::min<size_t>(256, n - start);
+      const T *x = input + start;
+      std::fill(block, block + len, c[degree]);
+      for (size_t k = degree; k-- > 0;) {
+        const T ck = c[k];
+        for (size_t i = 0; i < len; i++) block[i] = static_cast<T>(block[i] * x[i] + ck);
+      }
+      std::copy(block, block + len, output + start);
+    }
+  }
+
+#ifdef EXPRTK_JS_AVX2_DISPATCH
+  // The same kernel compiled for AVX2
+  __attribute__((target("avx2"))) static void hornerAVX2(
+    const T *c, size_t degree, const T *input, T *output, size_t n) {
+    T block[256];
+    for (size_t start = 0; start < n; start += 256) {
+      const size_t len = std::min<size_t>(256, n - start);
+      const T *x = input + start;
+      std::fill(block, block + len, c[degree]);
+      for (size_t k = degree; k-- > 0;) {
+        const T ck = c[k];
+        for (size_t i = 0; i < len; i++) block[i] = static_cast<T>(block[i] * x[i] + ck);
+      }
+      std::copy(block, block + len, output + start);
+    }
+  }
+#endif
+
+  static kernel_t select();
+};
+
+#ifdef EXPRTK_JS_SSE2
+// The floating point kernels keep the accumulators in registers and interleave
+// several vectors to hide the latency of the dependent multiply-adds
+// There is no FMA so that every element is rounded the same way as the scalar tail
+template <> inline void Polynomial<double>::horner(const double *c, size_t degree, const double *x, double *y, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m128d r0 = _mm_set1_pd(c[degree]), r1 = r0;
+    const __m128d x0 = _mm_loadu_pd(x + i), x1 = _mm_loadu_pd(x + i + 2);
+    for (size_t k = degree; k-- > 0;) {
+      const __m128d ck = _mm_set1_pd(c[k]);
+      r0 = _mm_add_pd(_mm_mul_pd(r0, x0), ck);
+      r1 = _mm_add_pd(_mm_mul_pd(r1, x1), ck);
+    }
+    _mm_storeu_pd(y + i, r0);
+    _mm_storeu_pd(y + i + 2, r1);
+  }
+  for (; i < n; i++) {
+    double r = c[degree];
+    for (size_t k = degree; k-- > 0;) r = r * x[i] + c[k];
+    y[i] = r;
+  }
+}
+
+template <> inline void Polynomial<float>::horner(const float *c, size_t degree, const float *x, float *y, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    __m128 r0 = _mm_set1_ps(c[degree]), r1 = r0;
+    const __m128 x0 = _mm_loadu_ps(x + i), x1 = _mm_loadu_ps(x + i + 4);
+    for (size_t k = degree; k-- > 0;) {
+      const __m128 ck = _mm_set1_ps(c[k]);
+      r0 = _mm_add_ps(_mm_mul_ps(r0, x0), ck);
+      r1 = _mm_add_ps(_mm_mul_ps(r1, x1), ck);
+    }
+    _mm_storeu_ps(y + i, r0);
+    _mm_storeu_ps(y + i + 4, r1);
+  }
+  for (; i < n; i++) {
+    float r = c[degree];
+    for (size_t k = degree; k-- > 0;) r = r * x[i] + c[k];
+    y[i] = r;
+  }
+}
+#endif
+
+#ifdef EXPRTK_JS_AVX2_DISPATCH
+template <>
+__attribute__((target("avx2"))) inline void
+Polynomial<double>::hornerAVX2(const double *c, size_t degree, const double *x, double *y, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) {
+    __m256d r0 = _mm256_set1_pd(c[degree]), r1 = r0, r2 = r0, r3 = r0;
+    const __m256d x0 = _mm256_loadu_pd(x + i), x1 = _mm256_loadu_pd(x + i + 4);
+    const __m256d x2 = _mm256_loadu_pd(x + i + 8), x3 = _mm256_loadu_pd(x + i + 12);
+    for (size_t k = degree; k-- > 0;) {
+      const __m256d ck = _mm256_set1_pd(c[k]);
+      r0 = _mm256_add_pd(_mm256_mul_pd(r0, x0), ck);
+      r1 = _mm256_add_pd(_mm256_mul_pd(r1, x1), ck);
+      r2 = _mm256_add_pd(_mm256_mul_pd(r2, x2), ck);
+      r3 = _mm256_add_pd(_mm256_mul_pd(r3, x3), ck);
+    }
+    _mm256_storeu_pd(y + i, r0);
+    _mm256_storeu_pd(y + i + 4, r1);
+    _mm256_storeu_pd(y + i + 8, r2);
+    _mm256_storeu_pd(y + i + 12, r3);
+  }
+  horner(c, degree, x + i, y + i, n - i);
+}
+
+template <>
+__attribute__((target("avx2"))) inline void
+Polynomial<float>::hornerAVX2(const float *c, size_t degree, const float *x, float *y, size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256 r0 = _mm256_set1_ps(c[degree]), r1 = r0, r2 = r0, r3 = r0;
+    const __m256 x0 = _mm256_loadu_ps(x + i), x1 = _mm256_loadu_ps(x + i + 8);
+    const __m256 x2 = _mm256_loadu_ps(x + i + 16), x3 = _mm256_loadu_ps(x + i + 24);
+    for (size_t k = degree; k-- > 0;) {
+      const __m256 ck = _mm256_set1_ps(c[k]);
+      r0 = _mm256_add_ps(_mm256_mul_ps(r0, x0), ck);
+      r1 = _mm256_add_ps(_mm256_mul_ps(r1, x1), ck);
+      r2 = _mm256_add_ps(_mm256_mul_ps(r2, x2), ck);
+      r3 = _mm256_add_ps(_mm256_mul_ps(r3, x3), ck);
+    }
+    _mm256_storeu_ps(y + i, r0);
+    _mm256_storeu_ps(y + i + 8, r1);
+    _mm256_storeu_ps(y + i + 16, r2);
+    _mm256_storeu_ps(y + i + 24, r3);
+  }
+  horner(c, degree, x + i, y + i, n - i);
+}
+#endif
+
+template <typename T> typename Polynomial<T>::kernel_t Polynomial<T>::select() {
+#ifdef EXPRTK_JS_AVX2_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) return hornerAVX2;
+#endif
+  return horner;
+}
+
+} // namespace vm
+} // namespace exprtk_js
@@ -1,30 +1,121 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <mutex>
+#include <thread>
+
+#ifdef __linux__
+#include <linux/futex.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
+
+// Tell the CPU that this is a spin loop,
+// this saves power and leaves the core to the other hyperthread
+inline void cpuRelax() {
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+  _mm_pause();
+#elif defined(__aarch64__) || defined(__arm__)
+  asm volatile("yield");
+#endif
+}
+
+// Spin until `ready()` returns true for at most `spinTime`
+// Returns false if the time has elapsed and the caller should park
+// Parking and waking up a thread costs a few microseconds in the kernel,
+// waiting for something that is about to happen is cheaper in user space
+// On a single CPU spinning only delays the thread that we are waiting for
+static constexpr std::chrono::microseconds spinTime(50);
+
+template <typename F> inline bool spinWait(const F &ready) {
+  static const bool multicore = std::thread::hardware_concurrency() > 1;
+  if (!multicore) return ready();
+  auto deadline = std::chrono::steady_clock::now() + spinTime;
+  while (true) {
+    // Reading the clock costs more than a pause
+    for (size_t i = 0; i < 64; i++) {
+      if (ready()) return true;
+      cpuRelax();
+    }
+    if (std::chrono::steady_clock::now() > deadline) return false;
+  }
+}
 
 // This is a simple binary semaphore that does not exist in C++14
 // Reminder: a semaphore can be unlocked by anyone
 // while a mutex can be unlocked only by its owner
+// lock() spins for a while before parking the thread - the typical user
+// is the main thread waiting for the worker threads of a synchronous call
+// which are usually only a few microseconds away from finishing
+// This semaphore can guard its own deletion: once unlock() has
+// released it, it does not touch its memory anymore
+// https://github.com/mmomtchev/exprtk.js/issues/31
 class Semaphore {
     public:
+#ifdef __linux__
+  Semaphore(bool initial) : state(initial ? locked : unlocked) {
+  }
+#else
   Semaphore(bool initial) : mtx(), cond(), busy(initial) {
   }
+#endif
 
   Semaphore(const Semaphore &Semaphore) = delete;
   Semaphore(Semaphore &&Semaphore) = delete;
   Semaphore &operator=(const Semaphore &Semaphore) = delete;
   Semaphore &operator=(Semaphore &&Semaphore) = delete;
 
+#ifdef __linux__
+  // A futex: the state is a word in user space and the kernel
+  // is called only when there is a thread to park or to wake up
   void inline lock() {
+    if (spinWait([this]() { return acquire(); })) return;
+    // From now on the state says that there may be a parked thread
+    // and the next unlock() will have to wake it up
+    while (state.exchange(parked, std::memory_order_acquire) != unlocked)
+      syscall(SYS_futex, reinterpret_cast<int *>(&state), FUTEX_WAIT_PRIVATE, parked, nullptr, nullptr, 0);
+  }
+
+  void inline unlock() {
+    // The address is only a key for the kernel, it does not
+    // matter if the semaphore has already been deleted by then
+    if (state.exchange(unlocked, std::memory_order_release) == parked)
+      syscall(SYS_futex, reinterpret_cast<int *>(&state), FUTEX_WAKE_PRIVATE, 1, nullptr, nullptr, 0);
+  }
+
+    private:
+  static constexpr int unlocked = 0;
+  static constexpr int locked = 1;
+  static constexpr int parked = 2;
+  static_assert(sizeof(std::atomic<int>) == sizeof(int), "futex requires a plain int");
+  std::atomic<int> state;
+
+  inline bool acquire() {
+    int expected = unlocked;
+    return state.load(std::memory_order_relaxed) == unlocked &&
+           state.compare_exchange_strong(expected, locked, std::memory_order_acquire);
+  }
+#else
+  void inline lock() {
+    if (spinWait([this]() { return acquire(); })) {
+      // unlock() may still be holding the mutex
+      std::lock_guard<std::mutex> guard(mtx);
+      return;
+    }
     std::unique_lock<std::mutex> guard(mtx);
-    cond.wait(guard, [this]() { return !busy; });
-    busy = true;
+    cond.wait(guard, [this]() { return acquire(); });
   }
 
   void inline unlock() {
     // Normally for best performance the mutex should be released before calling notify_all
     // However this semaphore can guard its own deletion
     // In this case, the condition variable will disappear as soon as the mutex is released
-    // https://github.com/mmomtchev/exprtk.js/issues/31
     std::unique_lock<std::mutex> guard(mtx);
     busy = false;
     cond.notify_all();
@@ -33,5 +124,11 @@ class Semaphore {
     private:
   std::mutex mtx;
   std::condition_variable cond;
-  bool busy;
-};
\ No newline at end of file
+  std::atomic_bool busy;
+
+  inline bool acquire() {
+    bool expected = false;
+    return !busy.load(std::memory_order_relaxed) && busy.compare_exchange_strong(expected, true);
+  }
+#endif
+};
@@ -0,0 +1,980 @@
+#pragma once
+
+#include <exprtk.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+namespace exprtk_js {
+
+/**
+ * A register bytecode backend for the element-wise loops
+ *
+ * The ExprTk tree is lowered once, after the first instance has been compiled,
+ * to a linear program that is shared (read-only) by all instances.
+ * Every operation is executed by the same ExprTk primitive that the tree
+ * would have used, so the results are identical.
+ *
+ * Only pure expressions of scalar variables are supported: arithmetic,
+ * comparisons, logical operators, conditionals and the built-in functions
+ * that ExprTk implements as operators. Anything else (assignments, loops,
+ * vectors, local variables, user functions...) makes the lowering fail and
+ * the expression keeps using the tree.
+ *
+ * The same program can be run either one element at a time (Machine)
+ * or on blocks of elements (BlockMachine) where every instruction is
+ * a simple loop over the block that the compiler can auto-vectorize.
+ */
+enum class Backend : uint8_t { Tree, VM, Block };
+
+namespace vm {
+
+enum Opcode : uint8_t {
+  Add,
+  Sub,
+  Mul,
+  Div,
+  Neg,
+  // operations implemented by ExprTk's numeric::process
+  Unary,
+  Binary,
+  // ExprTk functions: the integer powers (the exponent is in `c`)
+  // and the unary and binary functions of the synthesized nodes
+  Call,
+  CallUnary,
+  CallBinary,
+  Min,
+  Max,
+  Clamp,
+  InRange,
+  IClamp,
+  // dst = a ? b : c
+  Select,
+  // skip the next `b` instructions when `a` is false / true
+  SkipIfFalse,
+  SkipIfTrue
+};
+
+template <typename T> struct Instruction {
+  typedef typename exprtk::details::functor_t<T>::ufunc_t ufunc_t;
+  typedef typename exprtk::details::functor_t<T>::bfunc_t bfunc_t;
+
+  Opcode op;
+  exprtk::details::operator_type operation;
+  uint32_t dst, a, b, c;
+  union {
+    T (*fn)(T);
+    ufunc_t ufn;
+    bfunc_t bfn;
+  };
+};
+
+template <typename T> class Program {
+    public:
+  typedef exprtk::details::expression_node<T> node_t;
+
+  // Scalar variables, in register order, these are the first registers
+  std::vector<std::string> variables;
+  // Initial register file, holds the constants
+  std::vector<T> registers;
+  std::vector<Instruction<T>> code;
+  uint32_t result;
+
+  // Returns nullptr if the expression cannot be lowered
+  static std::shared_ptr<const Program<T>>
+  lower(const exprtk::expression<T> &expression, const exprtk::symbol_table<T> &symbolTable) {
+    std::shared_ptr<Program<T>> p(new Program<T>);
+    std::vector<std::string> names;
+    symbolTable.get_variable_list(names);
+    for (auto const &name : names) {
+      p->variables.push_back(name);
+      p->addresses.push_back(&symbolTable.get_variable(name)->ref());
+      p->registers.push_back(T(0));
+    }
+
+    node_t *root = exprtk::expression_helper<T>::root(expression);
+    if (root == nullptr) return nullptr;
+    p->result = p->lowerNode(root);
+    if (p->failed) return nullptr;
+    p->addresses.clear();
+    return p;
+  }
+
+  inline size_t size() const {
+    return code.size();
+  }
+
+    private:
+  Program() : result(0), failed(false) {
+  }
+
+  // Used only while lowering
+  std::vector<const T *> addresses;
+  bool failed;
+
+  inline uint32_t fail() {
+    failed = true;
+    return 0;
+  }
+
+  inline uint32_t variable(const T &ref) {
+    for (size_t i = 0; i < addresses.size(); i++)
+      if (addresses[i] == &ref) return static_cast<uint32_t>(i);
+    // Local variables and anything else that is not in the symbol table
+    return fail();
+  }
+
+  inline uint32_t constant(const T v) {
+    for (size_t i = addresses.size(); i < registers.size(); i++)
+      if (std::equal_to<T>()(registers[i], v)) return static_cast<uint32_t>(i);
+    // NaN is not equal to itself and will never be shared
+    return push(v);
+  }
+
+  // Constants are never written, all other registers are written only once
+  // except the result of a conditional
+  inline uint32_t push(const T v) {
+    registers.push_back(v);
+    return static_cast<uint32_t>(registers.size() - 1);
+  }
+
+  inline uint32_t
+  emit(Opcode op, uint32_t a, uint32_t b = 0, uint32_t c = 0, exprtk::details::operator_type operation =
+                                                                   exprtk::details::e_default) {
+    uint32_t dst = push(T(0));
+    code.push_back({op, operation, dst, a, b, c, {nullptr}});
+    return dst;
+  }
+
+  // Returns the position of the instruction, the length is filled later
+  inline size_t skip(Opcode op, uint32_t condition) {
+    code.push_back({op, exprtk::details::e_default, 0, condition, 0, 0, {nullptr}});
+    return code.size() - 1;
+  }
+
+  inline uint32_t power(T (*fn)(T), unsigned exponent, uint32_t a) {
+    uint32_t dst = emit(Call, a, 0, exponent);
+    code.back().fn = fn;
+    return dst;
+  }
+
+  inline uint32_t call(typename Instruction<T>::ufunc_t fn, uint32_t a) {
+    uint32_t dst = emit(CallUnary, a);
+    code.back().ufn = fn;
+    return dst;
+  }
+
+  inline uint32_t call(typename Instruction<T>::bfunc_t fn, uint32_t a, uint32_t b) {
+    uint32_t dst = emit(CallBinary, a, b);
+    code.back().bfn = fn;
+    return dst;
+  }
+
+  inline uint32_t unary(exprtk::details::operator_type operation, uint32_t a) {
+    switch (operation) {
+      case exprtk::details::e_neg:
+        return emit(Neg, a);
+      case exprtk::details::e_abs:
+      case exprtk::details::e_acos:
+      case exprtk::details::e_acosh:
+      case exprtk::details::e_asin:
+      case exprtk::details::e_asinh:
+      case exprtk::details::e_atan:
+      case exprtk::details::e_atanh:
+      case exprtk::details::e_ceil:
+      case exprtk::details::e_cos:
+      case exprtk::details::e_cosh:
+      case exprtk::details::e_exp:
+      case exprtk::details::e_expm1:
+      case exprtk::details::e_floor:
+      case exprtk::details::e_log:
+      case exprtk::details::e_log10:
+      case exprtk::details::e_log2:
+      case exprtk::details::e_log1p:
+      case exprtk::details::e_pos:
+      case exprtk::details::e_round:
+      case exprtk::details::e_sin:
+      case exprtk::details::e_sinc:
+      case exprtk::details::e_sinh:
+      case exprtk::details::e_sqrt:
+      case exprtk::details::e_tan:
+      case exprtk::details::e_tanh:
+      case exprtk::details::e_cot:
+      case exprtk::details::e_sec:
+      case exprtk::details::e_csc:
+      case exprtk::details::e_r2d:
+      case exprtk::details::e_d2r:
+      case exprtk::details::e_d2g:
+      case exprtk::details::e_g2d:
+      case exprtk::details::e_notl:
+      case exprtk::details::e_sgn:
+      case exprtk::details::e_erf:
+      case exprtk::details::e_erfc:
+      case exprtk::details::e_ncdf:
+      case exprtk::details::e_frac:
+      case exprtk::details::e_trunc:
+        return emit(Unary, a, 0, 0, operation);
+      default:
+        return fail();
+    }
+  }
+
+  inline uint32_t binary(exprtk::details::operator_type operation, uint32_t a, uint32_t b) {
+    switch (operation) {
+      case exprtk::details::e_add:
+        return emit(Add, a, b);
+      case exprtk::details::e_sub:
+        return emit(Sub, a, b);
+      case exprtk::details::e_mul:
+        return emit(Mul, a, b);
+      case exprtk::details::e_div:
+        return emit(Div, a, b);
+      case exprtk::details::e_mod:
+      case exprtk::details::e_pow:
+      case exprtk::details::e_atan2:
+      case exprtk::details::e_min:
+      case exprtk::details::e_max:
+      case exprtk::details::e_logn:
+      case exprtk::details::e_lt:
+      case exprtk::details::e_lte:
+      case exprtk::details::e_eq:
+      case exprtk::details::e_ne:
+      case exprtk::details::e_gte:
+      case exprtk::details::e_gt:
+      case exprtk::details::e_and:
+      case exprtk::details::e_nand:
+      case exprtk::details::e_or:
+      case exprtk::details::e_nor:
+      case exprtk::details::e_xor:
+      case exprtk::details::e_xnor:
+      case exprtk::details::e_root:
+      case exprtk::details::e_roundn:
+      case exprtk::details::e_equal:
+      case exprtk::details::e_nequal:
+      case exprtk::details::e_hypot:
+        return emit(Binary, a, b, 0, operation);
+      default:
+        return fail();
+    }
+  }
+
+  // The ExprTk nodes that do not have a virtual operation(),
+  // the operator is a template argument
+  template <template <typename, typename> class Node, template <typename> class... Ops>
+  static inline bool findOperation(node_t *node, exprtk::details::operator_type &operation) {
+    bool found = false;
+    (void)((dynamic_cast<Node<T, Ops<T>> *>(node) != nullptr
+              ? (operation = Ops<T>::operation(), found = true)
+              : false) ||
+           ...);
+    return found;
+  }
+
+  template <template <typename, typename> class Node>
+  static inline bool findBinaryOperation(node_t *node, exprtk::details::operator_type &operation) {
+    using namespace exprtk::details;
+    return findOperation<Node, add_op, sub_op, mul_op, div_op, mod_op, pow_op, lt_op, lte_op, gt_op, gte_op, eq_op,
+                         equal_op, ne_op, and_op, nand_op, or_op, nor_op, xor_op, xnor_op>(node, operation);
+  }
+
+  static inline bool findUnaryOperation(node_t *node, exprtk::details::operator_type &operation) {
+    using namespace exprtk::details;
+    return findOperation<unary_branch_node, abs_op, acos_op, acosh_op, asin_op, asinh_op, atan_op, atanh_op, ceil_op,
+                         cos_op, cosh_op, cot_op, csc_op, d2g_op, d2r_op, erf_op, erfc_op, exp_op, expm1_op, floor_op,
+                         frac_op, g2d_op, log_op, log10_op, log2_op, log1p_op, ncdf_op, neg_op, notl_op, pos_op,
+                         r2d_op, round_op, sec_op, sgn_op, sin_op, sinc_op, sinh_op, sqrt_op, tan_op, tanh_op,
+                         trunc_op>(node, operation);
+  }
+
+  // x^N for a constant integer N is a template argument too
+  template <unsigned N> inline bool lowerPower(node_t *node, uint32_t &r) {
+    using namespace exprtk::details;
+    typedef numeric::fast_exp<T, N> pow_t;
+    if (auto *n = dynamic_cast<ipow_node<T, pow_t> *>(node)) {
+      r = power(pow_t::result, N, variable(n->v()));
+      return true;
+    }
+    if (auto *n = dynamic_cast<bipow_node<T, pow_t> *>(node)) {
+      r = power(pow_t::result, N, lowerNode(n->branch(0)));
+      return true;
+    }
+    if (auto *n = dynamic_cast<ipowinv_node<T, pow_t> *>(node)) {
+      r = emit(Div, constant(T(1)), power(pow_t::result, N, variable(n->v())));
+      return true;
+    }
+    if (auto *n = dynamic_cast<bipowninv_node<T, pow_t> *>(node)) {
+      r = emit(Div, constant(T(1)), power(pow_t::result, N, lowerNode(n->branch(0))));
+      return true;
+    }
+    if constexpr (N < 60)
+      return lowerPower<N + 1>(node, r);
+    else
+      return false;
+  }
+
+  // The special functions are fully parenthesized expressions
+  // with the four basic operators such as "(t*t)+(t/t)"
+  uint32_t lowerPattern(const char *&p, const uint32_t *args, size_t &arg) {
+    uint32_t left = lowerPatternTerm(p, args, arg);
+    if (*p == '\0' || *p == ')') return left;
+    char op = *p++;
+    uint32_t right = lowerPatternTerm(p, args, arg);
+    switch (op) {
+      case '+':
+        return emit(Add, left, right);
+      case '-':
+        return emit(Sub, left, right);
+      case '*':
+        return emit(Mul, left, right);
+      case '/':
+        return emit(Div, left, right);
+    }
+    return fail();
+  }
+
+  uint32_t lowerPatternTerm(const char *&p, const uint32_t *args, size_t &arg) {
+    if (*p == 't') {
+      p++;
+      if (arg >= 4) return fail();
+      return args[arg++];
+    }
+    if (*p == '(') {
+      p++;
+      uint32_t r = lowerPattern(p, args, arg);
+      if (*p++ != ')') return fail();
+      return r;
+    }
+    return fail();
+  }
+
+  inline uint32_t lowerSpecialFunction(const std::string &id, const uint32_t *args, size_t n) {
+    if (id.find('t') == std::string::npos) return fail();
+    const char *p = id.c_str();
+    size_t arg = 0;
+    uint32_t r = lowerPattern(p, args, arg);
+    if (*p != '\0' || arg != n) return fail();
+    return r;
+  }
+
+  template <typename T0, typename T1, typename T2> inline bool lowerSF3(node_t *node, uint32_t &r) {
+    auto *n = dynamic_cast<exprtk::details::sf3ext_type_node<T, T0, T1, T2> *>(node);
+    if (n == nullptr) return false;
+    uint32_t args[] = {load<T0>(n->t0()), load<T1>(n->t1()), load<T2>(n->t2())};
+    r = lowerSpecialFunction(n->type_id(), args, 3);
+    return true;
+  }
+
+  template <typename T0, typename T1, typename T2, typename T3> inline bool lowerSF4(node_t *node, uint32_t &r) {
+    auto *n = dynamic_cast<exprtk::details::sf4ext_type_node<T, T0, T1, T2, T3> *>(node);
+    if (n == nullptr) return false;
+    uint32_t args[] = {load<T0>(n->t0()), load<T1>(n->t1()), load<T2>(n->t2()), load<T3>(n->t3())};
+    r = lowerSpecialFunction(n->type_id(), args, 4);
+    return true;
+  }
+
+  // The other synthesized nodes combine ExprTk's binary functions
+  template <typename T0, typename T1, typename T2> inline bool lowerT3(node_t *node, uint32_t &r) {
+    using namespace exprtk::details;
+    typedef T0oT1oT2process<T> process;
+    if (auto *n = dynamic_cast<T0oT1oT2<T, T0, T1, T2, typename process::mode0> *>(node)) {
+      uint32_t t0 = load<T0>(n->t0()), t1 = load<T1>(n->t1()), t2 = load<T2>(n->t2());
+      r = call(n->f1(), call(n->f0(), t0, t1), t2);
+      return true;
+    }
+    if (auto *n = dynamic_cast<T0oT1oT2<T, T0, T1, T2, typename process::mode1> *>(node)) {
+      uint32_t t0 = load<T0>(n->t0()), t1 = load<T1>(n->t1()), t2 = load<T2>(n->t2());
+      r = call(n->f0(), t0, call(n->f1(), t1, t2));
+      return true;
+    }
+    return false;
+  }
+
+  template <typename T0, typename T1, typename T2, typename T3> inline bool lowerT4(node_t *node, uint32_t &r) {
+    using namespace exprtk::details;
+    typedef T0oT1oT20T3process<T> process;
+    auto lowerMode = [this, node, &r](auto mode, auto build) {
+      typedef T0oT1oT2oT3<T, T0, T1, T2, T3, decltype(mode)> node_type;
+      if (auto *n = dynamic_cast<node_type *>(node)) {
+        uint32_t t[] = {load<T0>(n->t0()), load<T1>(n->t1()), load<T2>(n->t2()), load<T3>(n->t3())};
+        r = build(n->f0(), n->f1(), n->f2(), t);
+        return true;
+      }
+      return false;
+    };
+    typedef typename Instruction<T>::bfunc_t f;
+    return lowerMode(typename process::mode0(), [this](f f0, f f1, f f2, uint32_t *t) {
+             return call(f1, call(f0, t[0], t[1]), call(f2, t[2], t[3]));
+           }) ||
+      lowerMode(typename process::mode1(), [this](f f0, f f1, f f2, uint32_t *t) {
+             return call(f0, t[0], call(f1, t[1], call(f2, t[2], t[3])));
+           }) ||
+      lowerMode(typename process::mode2(), [this](f f0, f f1, f f2, uint32_t *t) {
+             return call(f0, t[0], call(f2, call(f1, t[1], t[2]), t[3]));
+           }) ||
+      lowerMode(typename process::mode3(), [this](f f0, f f1, f f2, uint32_t *t) {
+             return call(f2, call(f1, call(f0, t[0], t[1]), t[2]), t[3]);
+           }) ||
+      lowerMode(typename process::mode4(), [this](f f0, f f1, f f2, uint32_t *t) {
+             return call(f2, call(f0, t[0], call(f1, t[1], t[2])), t[3]);
+           });
+  }
+
+  // A variable operand is a reference, a constant operand is a value
+  template <typename Arg> inline uint32_t load(Arg v) {
+    if constexpr (std::is_reference<Arg>::value)
+      return variable(v);
+    else
+      return constant(v);
+  }
+
+  template <template <typename> class Op> inline bool lowerArgs(node_t *node, std::vector<uint32_t> &args) {
+    using namespace exprtk::details;
+    if (auto *n = dynamic_cast<vararg_node<T, Op<T>> *>(node)) {
+      for (size_t i = 0; i < n->size(); i++) args.push_back(lowerNode(n->branch(i)));
+      return true;
+    }
+    if (auto *n = dynamic_cast<vararg_varnode<T, Op<T>> *>(node)) {
+      for (size_t i = 0; i < n->size(); i++) args.push_back(variable(n->v(i)));
+      return true;
+    }
+    return false;
+  }
+
+  inline uint32_t chain(Opcode op, uint32_t first, const std::vector<uint32_t> &args, size_t from) {
+    uint32_t r = first;
+    for (size_t i = from; i < args.size(); i++) r = emit(op, r, args[i]);
+    return r;
+  }
+
+  // Same order of evaluation as ExprTk as it matters for NaNs and rounding
+  uint32_t lowerVarArg(node_t *node) {
+    using namespace exprtk::details;
+    std::vector<uint32_t> args;
+    if (lowerArgs<vararg_min_op>(node, args) || lowerArgs<vararg_max_op>(node, args)) {
+      Opcode op = dynamic_cast<vararg_node<T, vararg_min_op<T>> *>(node) ||
+          dynamic_cast<vararg_varnode<T, vararg_min_op<T>> *>(node)
+        ? Min
+        : Max;
+      switch (args.size()) {
+        case 0:
+          return constant(T(0));
+        case 4:
+          return emit(op, emit(op, args[0], args[1]), emit(op, args[2], args[3]));
+        case 5:
+          return emit(op, emit(op, emit(op, args[0], args[1]), emit(op, args[2], args[3])), args[4]);
+      }
+      return chain(op, args[0], args, 1);
+    }
+    if (lowerArgs<vararg_add_op>(node, args)) {
+      if (args.size() == 0) return constant(T(0));
+      if (args.size() > 5) return chain(Add, constant(T(0)), args, 0);
+      return chain(Add, args[0], args, 1);
+    }
+    if (lowerArgs<vararg_mul_op>(node, args)) {
+      if (args.size() == 0) return constant(T(0));
+      return chain(Mul, args[0], args, 1);
+    }
+    if (lowerArgs<vararg_avg_op>(node, args)) {
+      if (args.size() == 0) return constant(T(0));
+      if (args.size() == 1) return args[0];
+      if (args.size() > 5) return fail();
+      return emit(Div, chain(Add, args[0], args, 1), constant(T(args.size())));
+    }
+    return fail();
+  }
+
+  uint32_t lowerConditional(node_t *node) {
+    using namespace exprtk::details;
+    node_t *alternative = nullptr;
+    if (auto *n = dynamic_cast<conditional_node<T> *>(node))
+      alternative = n->branch(2);
+    else if (dynamic_cast<cons_conditional_node<T> *>(node) == nullptr)
+      return fail();
+
+    // Only the taken branch is evaluated, some branches
+    // can have side effects such as integer division by zero
+    uint32_t condition = lowerNode(node->branch(0));
+    size_t skipConsequent = skip(SkipIfFalse, condition);
+    uint32_t consequent = lowerNode(node->branch(1));
+    code[skipConsequent].b = static_cast<uint32_t>(code.size() - skipConsequent - 1);
+
+    uint32_t other;
+    if (alternative != nullptr) {
+      size_t skipAlternative = skip(SkipIfTrue, condition);
+      other = lowerNode(alternative);
+      code[skipAlternative].b = static_cast<uint32_t>(code.size() - skipAlternative - 1);
+    } else {
+      other = push(std::numeric_limits<T>::quiet_NaN());
+    }
+    return emit(Select, condition, consequent, other);
+  }
+
+  uint32_t lowerNode(node_t *node) {
+    using namespace exprtk::details;
+    typedef expression_node<T> en;
+    typedef const T &v_t;
+    typedef const T c_t;
+    uint32_t r = 0;
+
+    if (failed || node == nullptr) return fail();
+
+    switch (node->type()) {
+      case en::e_constant:
+        return constant(node->value());
+      case en::e_variable:
+        return variable(static_cast<variable_node<T> *>(node)->ref());
+      case en::e_unary:
+        if (auto *n = dynamic_cast<unary_node<T> *>(node)) return unary(n->operation(), lowerNode(n->branch(0)));
+        return fail();
+      case en::e_binary:
+        if (auto *n = dynamic_cast<binary_node<T> *>(node))
+          return binary(n->operation(), lowerNode(n->branch(0)), lowerNode(n->branch(1)));
+        return fail();
+      case en::e_binary_ext: {
+        operator_type operation;
+        if (findBinaryOperation<binary_ext_node>(node, operation))
+          return binary(operation, lowerNode(node->branch(0)), lowerNode(node->branch(1)));
+        return fail();
+      }
+      case en::e_conditional:
+        return lowerConditional(node);
+      case en::e_trinary:
+        if (auto *n = dynamic_cast<trinary_node<T> *>(node)) {
+          uint32_t a = lowerNode(n->branch(0)), b = lowerNode(n->branch(1)), c = lowerNode(n->branch(2));
+          switch (n->operation()) {
+            case e_clamp:
+              return emit(Clamp, a, b, c);
+            case e_inrange:
+              return emit(InRange, a, b, c);
+            case e_iclamp:
+              return emit(IClamp, a, b, c);
+            default:
+              return fail();
+          }
+        }
+        return fail();
+      case en::e_vararg:
+        return lowerVarArg(node);
+      case en::e_uvouv:
+        if (auto *n = dynamic_cast<uvouv_node<T> *>(node))
+          return call(n->f(), call(n->u0(), variable(n->v0())), call(n->u1(), variable(n->v1())));
+        return fail();
+      case en::e_ipow:
+      case en::e_ipowinv:
+        if (lowerPower<1>(node, r)) return r;
+        return fail();
+      case en::e_vovov:
+      case en::e_vovoc:
+      case en::e_vocov:
+      case en::e_covov:
+      case en::e_covoc:
+        if (
+          lowerSF3<v_t, v_t, v_t>(node, r) || lowerSF3<v_t, v_t, c_t>(node, r) || lowerSF3<v_t, c_t, v_t>(node, r) ||
+          lowerSF3<c_t, v_t, v_t>(node, r) || lowerSF3<c_t, v_t, c_t>(node, r) || lowerT3<v_t, v_t, v_t>(node, r) ||
+          lowerT3<v_t, v_t, c_t>(node, r) || lowerT3<v_t, c_t, v_t>(node, r) || lowerT3<c_t, v_t, v_t>(node, r) ||
+          lowerT3<c_t, v_t, c_t>(node, r))
+          return r;
+        return fail();
+      case en::e_vovovov:
+      case en::e_vovovoc:
+      case en::e_vovocov:
+      case en::e_vocovov:
+      case en::e_covovov:
+      case en::e_covocov:
+      case en::e_vocovoc:
+      case en::e_covovoc:
+      case en::e_vococov:
+        if (
+          lowerSF4<v_t, v_t, v_t, v_t>(node, r) || lowerSF4<v_t, v_t, v_t, c_t>(node, r) ||
+          lowerSF4<v_t, v_t, c_t, v_t>(node, r) || lowerSF4<v_t, c_t, v_t, v_t>(node, r) ||
+          lowerSF4<c_t, v_t, v_t, v_t>(node, r) || lowerSF4<c_t, v_t, c_t, v_t>(node, r) ||
+          lowerSF4<v_t, c_t, v_t, c_t>(node, r) || lowerSF4<c_t, v_t, v_t, c_t>(node, r) ||
+          lowerSF4<v_t, c_t, c_t, v_t>(node, r))
+          return r;
+        return fail();
+      default:
+        break;
+    }
+
+    // These do not have a node type
+    if (dynamic_cast<T0oT1oT2oT3_base_node<T> *>(node)) {
+      if (
+        lowerT4<v_t, v_t, v_t, v_t>(node, r) || lowerT4<v_t, v_t, v_t, c_t>(node, r) ||
+        lowerT4<v_t, v_t, c_t, v_t>(node, r) || lowerT4<v_t, c_t, v_t, v_t>(node, r) ||
+        lowerT4<c_t, v_t, v_t, v_t>(node, r) || lowerT4<c_t, v_t, c_t, v_t>(node, r) ||
+        lowerT4<v_t, c_t, v_t, c_t>(node, r) || lowerT4<c_t, v_t, v_t, c_t>(node, r) ||
+        lowerT4<v_t, c_t, c_t, v_t>(node, r))
+        return r;
+      return fail();
+    }
+
+    // The operators on variables, constants and branches
+    // have the node type of the operator (e_add, e_sin...)
+    if (auto *n = dynamic_cast<vov_base_node<T> *>(node))
+      return binary(n->operation(), variable(n->v0()), variable(n->v1()));
+    if (auto *n = dynamic_cast<cov_base_node<T> *>(node))
+      return binary(n->operation(), constant(n->c()), variable(n->v()));
+    if (auto *n = dynamic_cast<voc_base_node<T> *>(node))
+      return binary(n->operation(), variable(n->v()), constant(n->c()));
+    if (auto *n = dynamic_cast<cob_base_node<T> *>(node))
+      return binary(n->operation(), constant(n->c()), lowerNode(n->branch(0)));
+    if (auto *n = dynamic_cast<boc_base_node<T> *>(node))
+      return binary(n->operation(), lowerNode(n->branch(0)), constant(n->c()));
+    if (auto *n = dynamic_cast<uv_base_node<T> *>(node)) return unary(n->operation(), variable(n->v()));
+    operator_type operation;
+    if (auto *n = dynamic_cast<vob_base_node<T> *>(node)) {
+      if (findBinaryOperation<vob_node>(node, operation))
+        return binary(operation, variable(n->v()), lowerNode(n->branch(0)));
+      return fail();
+    }
+    if (auto *n = dynamic_cast<bov_base_node<T> *>(node)) {
+      if (findBinaryOperation<bov_node>(node, operation))
+        return binary(operation, lowerNode(n->branch(0)), variable(n->v()));
+      return fail();
+    }
+    if (findUnaryOperation(node, operation)) return unary(operation, lowerNode(node->branch(0)));
+    return fail();
+  }
+};
+
+// Runs a Program on the variables of an ExpressionInstance
+// Each evaluating thread has its own Machine
+template <typename T> class Machine {
+    public:
+  inline Machine(const Program<T> &program, const exprtk::symbol_table<T> &symbolTable)
+    : registers(program.registers),
+      code(program.code.data()),
+      codeEnd(program.code.data() + program.code.size()),
+      result(program.result) {
+    for (auto const &name : program.variables) variables.push_back(&symbolTable.get_variable(name)->ref());
+  }
+
+  inline T operator()() {
+    T *r = registers.data();
+    const size_t n = variables.size();
+    for (size_t i = 0; i < n; i++) r[i] = *variables[i];
+
+    for (const Instruction<T> *i = code; i < codeEnd; i++) {
+      switch (i->op) {
+        case Add:
+          r[i->dst] = r[i->a] + r[i->b];
+          break;
+        case Sub:
+          r[i->dst] = r[i->a] - r[i->b];
+          break;
+        case Mul:
+          r[i->dst] = r[i->a] * r[i->b];
+          break;
+        case Div:
+          r[i->dst] = r[i->a] / r[i->b];
+          break;
+        case Neg:
+          r[i->dst] = -r[i->a];
+          break;
+        case Unary:
+          r[i->dst] = exprtk::details::numeric::process<T>(i->operation, r[i->a]);
+          break;
+        case Binary:
+          r[i->dst] = exprtk::details::numeric::process<T>(i->operation, r[i->a], r[i->b]);
+          break;
+        case Call:
+          r[i->dst] = i->fn(r[i->a]);
+          break;
+        case CallUnary:
+          r[i->dst] = i->ufn(r[i->a]);
+          break;
+        case CallBinary:
+          r[i->dst] = i->bfn(r[i->a], r[i->b]);
+          break;
+        case Min:
+          r[i->dst] = std::min<T>(r[i->a], r[i->b]);
+          break;
+        case Max:
+          r[i->dst] = std::max<T>(r[i->a], r[i->b]);
+          break;
+        case Clamp: {
+          const T a0 = r[i->a], a1 = r[i->b], a2 = r[i->c];
+          r[i->dst] = (a1 < a0) ? a0 : (a1 > a2 ? a2 : a1);
+          break;
+        }
+        case InRange: {
+          const T a0 = r[i->a], a1 = r[i->b], a2 = r[i->c];
+          r[i->dst] = (a1 < a0) ? T(0) : ((a1 > a2) ? T(0) : T(1));
+          break;
+        }
+        case IClamp: {
+          const T a0 = r[i->a], a1 = r[i->b], a2 = r[i->c];
+          if ((a1 <= a0) || (a1 >= a2))
+            r[i->dst] = a1;
+          else
+            r[i->dst] = ((T(2) * a1 <= (a2 + a0)) ? a0 : a2);
+          break;
+        }
+        case Select:
+          r[i->dst] = std::not_equal_to<T>()(T(0), r[i->a]) ? r[i->b] : r[i->c];
+          break;
+        case SkipIfFalse:
+          if (!std::not_equal_to<T>()(T(0), r[i->a])) i += i->b;
+          break;
+        case SkipIfTrue:
+          if (std::not_equal_to<T>()(T(0), r[i->a])) i += i->b;
+          break;
+      }
+    }
+    return r[result];
+  }
+
+    private:
+  std::vector<T> registers;
+  std::vector<const T *> variables;
+  const Instruction<T> *code, *codeEnd;
+  uint32_t result;
+};
+
+/**
+ * Runs a Program on blocks of elements
+ *
+ * Every register holds a block of values, the variables are gathered
+ * element by element in their lanes and then each instruction processes
+ * the whole block at once - this amortizes the instruction dispatch
+ * over the block.
+ *
+ * The untaken arm of a conditional is skipped only when no element of
+ * the block needs it. Otherwise floating point types evaluate it for the
+ * whole block and discard the unused values, while integer types, where
+ * an untaken branch can trap (division by zero), evaluate it only in the
+ * lanes that take it.
+ */
+template <typename T> class BlockMachine {
+    public:
+  static constexpr size_t size = 256;
+
+  inline BlockMachine(const Program<T> &program, const exprtk::symbol_table<T> &symbolTable)
+    : registers(program.registers.size() * size),
+      code(program.code.data()),
+      codeEnd(program.code.data() + program.code.size()),
+      result(program.result),
+      pending(0) {
+    for (size_t j = 0; j < program.registers.size(); j++)
+      std::fill_n(registers.data() + j * size, size, program.registers[j]);
+    for (auto const &name : program.variables) variables.push_back(&symbolTable.get_variable(name)->ref());
+  }
+
+  // Gather the current values of the variables in the next lane,
+  // returns true when the block is full
+  inline bool push(uint8_t *output) {
+    T *r = registers.data();
+    const size_t n = variables.size();
+    for (size_t j = 0; j < n; j++) r[j * size + pending] = *variables[j];
+    outputs[pending++] = output;
+    return pending == size;
+  }
+
+  // Evaluate the pending lanes and store the results
+  template <typename Store> inline void flush(const Store &store) {
+    if (pending == 0) return;
+    run(code, codeEnd, 0, pending);
+    const T *r = reg(result);
+    for (size_t k = 0; k < pending; k++) store(outputs[k], r[k]);
+    pending = 0;
+  }
+
+    private:
+  std::vector<T> registers;
+  std::vector<const T *> variables;
+  const Instruction<T> *code, *codeEnd;
+  uint32_t result;
+  size_t pending;
+  uint8_t *outputs[size];
+
+  inline T *reg(uint32_t idx) {
+    return registers.data() + idx * size;
+  }
+
+  void run(const Instruction<T> *from, const Instruction<T> *to, size_t lo, size_t hi) {
+    for (const Instruction<T> *i = from; i < to; i++) {
+      switch (i->op) {
+        case Add: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b);
+          for (size_t k = lo; k < hi; k++) d[k] = a[k] + b[k];
+          break;
+        }
+        case Sub: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b);
+          for (size_t k = lo; k < hi; k++) d[k] = a[k] - b[k];
+          break;
+        }
+        case Mul: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b);
+          for (size_t k = lo; k < hi; k++) d[k] = a[k] * b[k];
+          break;
+        }
+        case Div: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b);
+          for (size_t k = lo; k < hi; k++) d[k] = a[k] / b[k];
+          break;
+        }
+        case Neg: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a);
+          for (size_t k = lo; k < hi; k++) d[k] = -a[k];
+          break;
+        }
+        case Unary: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a);
+          const auto operation = i->operation;
+          for (size_t k = lo; k < hi; k++) d[k] = exprtk::details::numeric::process<T>(operation, a[k]);
+          break;
+        }
+        case Binary: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b);
+          const auto operation = i->operation;
+          for (size_t k = lo; k < hi; k++) d[k] = exprtk::details::numeric::process<T>(operation, a[k], b[k]);
+          break;
+        }
+        case Call: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a);
+          const auto fn = i->fn;
+          for (size_t k = lo; k < hi; k++) d[k] = fn(a[k]);
+          break;
+        }
+        case CallUnary: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a);
+          const auto fn = i->ufn;
+          for (size_t k = lo; k < hi; k++) d[k] = fn(a[k]);
+          break;
+        }
+        case CallBinary: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b);
+          const auto fn = i->bfn;
+          for (size_t k = lo; k < hi; k++) d[k] = fn(a[k], b[k]);
+          break;
+        }
+        case Min: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b);
+          for (size_t k = lo; k < hi; k++) d[k] = std::min<T>(a[k], b[k]);
+          break;
+        }
+        case Max: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b);
+          for (size_t k = lo; k < hi; k++) d[k] = std::max<T>(a[k], b[k]);
+          break;
+        }
+        case Clamp: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b), *c = reg(i->c);
+          for (size_t k = lo; k < hi; k++) d[k] = (b[k] < a[k]) ? a[k] : (b[k] > c[k] ? c[k] : b[k]);
+          break;
+        }
+        case InRange: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b), *c = reg(i->c);
+          for (size_t k = lo; k < hi; k++) d[k] = (b[k] < a[k]) ? T(0) : ((b[k] > c[k]) ? T(0) : T(1));
+          break;
+        }
+        case IClamp: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b), *c = reg(i->c);
+          for (size_t k = lo; k < hi; k++) {
+            if ((b[k] <= a[k]) || (b[k] >= c[k]))
+              d[k] = b[k];
+            else
+              d[k] = ((T(2) * b[k] <= (c[k] + a[k])) ? a[k] : c[k]);
+          }
+          break;
+        }
+        case Select: {
+          T *d = reg(i->dst);
+          const T *a = reg(i->a), *b = reg(i->b), *c = reg(i->c);
+          for (size_t k = lo; k < hi; k++) d[k] = std::not_equal_to<T>()(T(0), a[k]) ? b[k] : c[k];
+          break;
+        }
+        case SkipIfFalse:
+        case SkipIfTrue: {
+          // The skipped region is needed by the lanes where the condition is `taken`
+          const bool taken = i->op == SkipIfFalse;
+          const T *a = reg(i->a);
+          const Instruction<T> *end = i + 1 + i->b;
+          size_t needed = 0;
+          for (size_t k = lo; k < hi; k++) needed += std::not_equal_to<T>()(T(0), a[k]) == taken;
+          if (needed == 0) {
+            i = end - 1;
+          } else if (needed != hi - lo && std::is_integral<T>::value) {
+            for (size_t k = lo; k < hi; k++)
+              if (std::not_equal_to<T>()(T(0), a[k]) == taken) run(i + 1, end, k, k + 1);
+            i = end - 1;
+          }
+          break;
+        }
+      }
+    }
+  }
+};
+
+} // namespace vm
+
+// Evaluates either with the ExprTk tree, the VM or the block VM
+//
+// Every evaluation writes its result to an output pointer, the block VM defers
+// the evaluation until a block is full so flush() must be called after the last one
+template <typename T> class Evaluator {
+    public:
+  inline Evaluator(
+    Backend backend,
+    const std::shared_ptr<const vm::Program<T>> &program,
+    const exprtk::expression<T> &expression,
+    const exprtk::symbol_table<T> &symbolTable)
+    : expression(expression),
+      machine(program && backend == Backend::VM ? new vm::Machine<T>(*program, symbolTable) : nullptr),
+      block(program && backend == Backend::Block ? new vm::BlockMachine<T>(*program, symbolTable) : nullptr) {
+  }
+
+  inline void operator()(T *output) {
+    (*this)(reinterpret_cast<uint8_t *>(output), storeValue);
+  }
+
+  // Store is called as store(output, value)
+  template <typename Store> inline void operator()(uint8_t *output, const Store &store) {
+    if (block) {
+      if (block->push(output)) block->flush(store);
+    } else if (machine) {
+      store(output, (*machine)());
+    } else {
+      store(output, expression.value());
+    }
+  }
+
+  inline void flush() {
+    flush(storeValue);
+  }
+
+  template <typename Store> inline void flush(const Store &store) {
+    if (block) block->flush(store);
+  }
+
+    private:
+  const exprtk::expression<T> &expression;
+  std::unique_ptr<vm::Machine<T>> machine;
+  std::unique_ptr<vm::BlockMachine<T>> block;
+
+  static inline void storeValue(uint8_t *output, T value) {
+    *reinterpret_cast<T *>(output) = value;
+  }
+};
+
+} // namespace exprtk_js
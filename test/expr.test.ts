@@ -2,6 +2,7 @@
 import Expression, { Float64 as expr } from 'exprtk.js';
 
 import { exec } from 'child_process';
+import { Worker } from 'worker_threads';
 import * as asyncHooks from 'async_hooks';
 import { inspect } from 'util';
 import * as os from 'os';
@@ -91,6 +92,34 @@ describe('Expression', () => {
             assert.throws(() => {
                 mean.maxParallel = 10e3;
             }, /environment variable EXPRTKJS_THREADS/);
+            for (const n of [0, NaN, -0.5]) {
+                assert.throws(() => {
+                    mean.maxParallel = n;
+                }, /maxParallel must be between 1 and/);
+            }
+            assert.equal(mean.maxParallel, 1);
+        });
+        it('should release the surplus instances when lowering the max parallel instances', () => {
+            const mean = new expr('a / 3 + x[10]', ['a'], { x: 12 });
+            mean.prepare();
+            const size = expr.cacheStats.size;
+            mean.maxParallel = 1;
+            assert.equal(expr.cacheStats.size, Math.min(size + os.cpus().length - 1, expr.cacheSize));
+            mean.maxParallel = os.cpus().length;
+            assert.equal(mean.maxParallel, os.cpus().length);
+            assert.equal(mean.eval(3, new Float64Array(12)), 1);
+        });
+        it('should accept a maxParallel option in the constructor', () => {
+            const mean = new expr('a + x[10]', ['a'], { x: 12 }, { maxParallel: 1 });
+            assert.equal(mean.maxParallel, 1);
+            assert.throws(() => {
+                new expr('a + x[10]', ['a'], { x: 12 }, { maxParallel: 10e3 });
+            }, /environment variable EXPRTKJS_THREADS/);
+            for (const n of [0, NaN, -0.5]) {
+                assert.throws(() => {
+                    new expr('a + x[10]', ['a'], { x: 12 }, { maxParallel: n });
+                }, /maxParallel must be between 1 and/);
+            }
         });
         it(`should have \`os.cpus().length=${os.cpus().length}\` number of worker threads by default`, () => {
             assert.equal(expr.maxParallel, os.cpus().length);
@@ -113,6 +142,689 @@ describe('Expression', () => {
                     done();
                 });
         });
+        it('should support resizing the number of worker threads', async () => {
+            const threads = expr.maxParallel;
+            try {
+                const a = new Float64Array(10000).map((_, i) => i);
+                const before = new expr('x * 2', ['x']);
+                expr.maxParallel = 1;
+                assert.equal(expr.maxParallel, 1);
+                assert.equal(new expr('x * 2', ['x']).maxParallel, 1);
+                assert.deepEqual(await before.mapAsync(before.maxParallel, a, 'x'), a.map((x) => x * 2));
+
+                expr.maxParallel = threads + 2;
+                assert.equal(expr.maxParallel, threads + 2);
+                before.maxParallel = threads + 2;
+                assert.equal(before.maxParallel, threads + 2);
+                assert.deepEqual(before.map(threads + 2, a, 'x'), a.map((x) => x * 2));
+                assert.deepEqual(await before.mapAsync(threads + 2, a, 'x'), a.map((x) => x * 2));
+                assert.throws(() => {
+                    before.maxParallel = threads + 3;
+                }, /Expression.maxParallel/);
+
+                assert.throws(() => {
+                    expr.maxParallel = 0;
+                }, /must be between 1 and/);
+            } finally {
+                expr.maxParallel = threads;
+            }
+        });
+        it('should support pinning the worker threads', async () => {
+            const mean = new expr('(a + b) / 2', ['a', 'b']);
+            const a = new Float64Array(10000).map((_, i) => i);
+            const b = new Float64Array(10000).fill(1);
+            assert.isFalse(expr.pinThreads);
+            try {
+                expr.pinThreads = true;
+                assert.isTrue(expr.pinThreads);
+                assert.deepEqual(mean.cwise(mean.maxParallel, { a, b }), a.map((x) => (x + 1) / 2));
+                assert.deepEqual(await mean.mapAsync(mean.maxParallel, a, 'a', { b: 1 }), a.map((x) => (x + 1) / 2));
+            } finally {
+                expr.pinThreads = false;
+            }
+            assert.throws(() => {
+                (expr as any).pinThreads = 1;
+            }, /must be a boolean/);
+        });
+        it('should reuse the memory of the finished calls', async () => {
+            const e = new expr('x * 2', ['x']);
+            const a = new Float64Array(1000).map((_, i) => i);
+            const ref = a.map((x) => x * 2);
+            for (let i = 0; i < 64; i++) {
+                const threads = i % e.maxParallel + 1;
+                assert.deepEqual(e.map(threads, a, 'x'), ref);
+                assert.deepEqual(await e.mapAsync(e.maxParallel - threads + 1, a, 'x'), ref);
+            }
+            // The calls still allocate, this only checks that the counting works
+            if (expr.allocations !== undefined) assert.isAbove(expr.allocations, 0);
+        });
+        it('should share the worker threads with the worker_threads', async () => {
+            const stats = expr.poolStats;
+            assert.equal(stats.threads, expr.maxParallel);
+            assert.isAtLeast(stats.envs, 1);
+            assert.isNumber(stats.pending);
+            const testCode = `
+                const { parentPort } = require('worker_threads');
+                const expr = require(${JSON.stringify(require.resolve('exprtk.js'))}).Float64;
+                const e = new expr('x * 2', ['x']);
+                e.mapAsync(e.maxParallel, new Float64Array(1000).fill(1), 'x')
+                    .then((r) => parentPort.postMessage({ stats: expr.poolStats, r: r[999] }));
+            `;
+            const workers = [new Worker(testCode, { eval: true }), new Worker(testCode, { eval: true })];
+            const results = await Promise.all(workers.map((w) => new Promise<any>((resolve, reject) => {
+                w.once('message', resolve);
+                w.once('error', reject);
+            })));
+            for (const result of results) {
+                assert.equal(result.r, 2);
+                assert.equal(result.stats.threads, stats.threads);
+                assert.isAtLeast(result.stats.envs, stats.envs + 1);
+            }
+            await Promise.all(workers.map((w) => w.terminate()));
+            assert.equal(expr.poolStats.envs, stats.envs);
+            assert.equal(expr.poolStats.threads, stats.threads);
+        });
+    });
+
+    describe('cache', () => {
+        it('should report the cache statistics', () => {
+            const stats = expr.cacheStats;
+            assert.isNumber(stats.size);
+            assert.isAtMost(stats.size, stats.maxSize);
+            assert.isNumber(stats.hits);
+            assert.isNumber(stats.misses);
+            assert.isNumber(stats.evictions);
+            assert.equal(stats.maxSize, expr.cacheSize);
+        });
+        it('should reuse the compiled instances of a collected Expression', async () => {
+            const text = 'a * b + 0.125';
+            let e: Expression.Float64 | null = new expr(text, ['a', 'b']);
+            assert.equal(e.eval(2, 3), 6.125);
+            e = null;
+            (global as any).gc();
+            await new Promise((resolve) => setImmediate(resolve));
+            const hits = expr.cacheStats.hits;
+            const e2 = new expr(text, ['a', 'b']);
+            assert.equal(expr.cacheStats.hits, hits + 1);
+            assert.equal(e2.eval(3, 4), 12.125);
+        });
+        it('should not reuse instances with a different symbol layout', () => {
+            const hits = expr.cacheStats.hits;
+            const e = new expr('a * b + 0.125', ['b', 'a']);
+            assert.equal(expr.cacheStats.hits, hits);
+            assert.equal(e.eval(2, 3), 6.125);
+        });
+        it('should support resizing the cache', () => {
+            const size = expr.cacheSize;
+            expr.cacheSize = 0;
+            assert.equal(expr.cacheStats.size, 0);
+            expr.cacheSize = size;
+            assert.equal(expr.cacheSize, size);
+            assert.throws(() => {
+                (expr as any).cacheSize = 'a';
+            }, /value must be a number/);
+        });
+    });
+
+    describe('prepare', () => {
+        it('should compile the instances ahead of time', () => {
+            const e = new expr('a * b + 0.25', ['a', 'b']);
+            assert.equal(e.prepare(), expr.maxParallel - 1);
+            assert.equal(e.maxActive, expr.maxParallel);
+            assert.equal(e.prepare(), 0);
+            assert.equal(e.eval(2, 3), 6.25);
+        });
+        it('should compile the instances ahead of time (async)', async () => {
+            const e = new expr('a * b + 0.375', ['a', 'b']);
+            assert.equal(await e.prepareAsync(1), 0);
+            assert.equal(await e.prepareAsync(), expr.maxParallel - 1);
+            assert.equal(e.maxActive, expr.maxParallel);
+            assert.equal(await e.evalAsync(2, 3), 6.375);
+        });
+        it('should accept a prepare option in the constructor', () => {
+            const e = new expr('a * b + 0.5', ['a', 'b'], undefined, { prepare: expr.maxParallel });
+            assert.equal(e.maxActive, expr.maxParallel);
+            assert.equal(e.eval(2, 3), 6.5);
+        });
+        it('should throw on invalid arguments', () => {
+            const e = new expr('a * b', ['a', 'b']);
+            assert.throws(() => {
+                e.prepare(expr.maxParallel + 1);
+            }, /must not exceed maxParallel/);
+            assert.throws(() => {
+                (e as any).prepare('a');
+            }, /instances must be a number/);
+            assert.throws(() => {
+                new expr('a * b', ['a', 'b'], undefined, { prepare: expr.maxParallel + 1 });
+            }, /must not exceed maxParallel/);
+            assert.throws(() => {
+                new (expr as any)('a * b', ['a', 'b'], undefined, 12);
+            }, /options must be an object/);
+        });
+        it('should not exceed the maxParallel of the Expression', () => {
+            if (expr.maxParallel < 2) return;
+            assert.throws(() => {
+                new expr('a * b', ['a', 'b'], undefined, { maxParallel: 1, prepare: 2 });
+            }, /prepare must not exceed maxParallel = 1/);
+            const e = new expr('a * b + 0.125', ['a', 'b']);
+            e.maxParallel = 1;
+            assert.throws(() => {
+                e.prepare(2);
+            }, /instances must not exceed maxParallel = 1/);
+            assert.equal(e.prepare(), 0);
+            assert.equal(e.maxActive, 1);
+            assert.equal(e.eval(2, 3), 6.125);
+        });
+    });
+
+    describe('settings', () => {
+        it('should enable everything by default', () => {
+            const e = new expr('a * b', ['a', 'b']);
+            assert.isTrue(e.settings.strengthReduction);
+            assert.isTrue(e.settings.loops);
+            assert.isTrue(Object.values(e.settings).every((x) => x === true));
+        });
+        it('should apply the parser settings', () => {
+            const e = new expr('a * b + 2 * a', ['a', 'b'], undefined,
+                { settings: { strengthReduction: false, commutativeCheck: false } });
+            assert.isFalse(e.settings.strengthReduction);
+            assert.isFalse(e.settings.commutativeCheck);
+            assert.isTrue(e.settings.joiner);
+            assert.equal(e.eval(2, 3), 10);
+            assert.throws(() => {
+                new expr('var s := 0; for (var i := 0; i < a; i += 1) { s += i }; s', ['a'], undefined,
+                    { settings: { loops: false } });
+            }, /failed compiling/);
+            assert.throws(() => {
+                new expr('b := a', ['a', 'b'], undefined, { settings: { assignments: false } });
+            }, /failed compiling/);
+        });
+        it('should not share instances between different settings', () => {
+            const hits = expr.cacheStats.hits;
+            const e1 = new expr('a * 4 + 0.125', ['a'], undefined, { settings: { replacer: false } });
+            const e2 = new expr('a * 4 + 0.125', ['a']);
+            assert.equal(expr.cacheStats.hits, hits);
+            assert.equal(e1.eval(2), e2.eval(2));
+        });
+        it('should throw on invalid settings', () => {
+            assert.throws(() => {
+                new (expr as any)('a * b', ['a', 'b'], undefined, { settings: { turbo: true } });
+            }, /turbo is not a valid parser setting/);
+            assert.throws(() => {
+                new (expr as any)('a * b', ['a', 'b'], undefined, { settings: { loops: 0 } });
+            }, /parser settings must be booleans/);
+        });
+    });
+
+    describe('backend', () => {
+        const a = new Float64Array(100).map((_, i) => i - 50);
+        const b = new Float64Array(100).map((_, i) => (i * 7) % 13 - 6);
+        const formulas = [
+            'a * a + 2 * a + 1',
+            'a > b ? a * b : a / (b + 0.5)',
+            'sin(a) * cos(b) + sqrt(abs(a))',
+            'clamp(-10, a, 10) + min(a, b, 3) - max(a, b)',
+            '(a + 1) * (b - 2) / 4 + a^3'
+        ];
+
+        it('should use the tree by default', () => {
+            assert.equal(new expr('a + b', ['a', 'b']).backend, 'tree');
+        });
+        for (const backend of ['vm', 'block'] as const) {
+            it(`should produce the same results with the ${backend} backend`, () => {
+                for (const f of formulas) {
+                    const tree = new expr(f, ['a', 'b']);
+                    const e = new expr(f, ['a', 'b'], undefined, { backend });
+                    assert.equal(e.backend, backend, f);
+                    assert.deepEqual(e.cwise({ a, b }), tree.cwise({ a, b }), f);
+                    assert.deepEqual(e.map(a, 'a', 3), tree.map(a, 'a', 3), f);
+                }
+            });
+        }
+        it('should evaluate blocks with partial results and type conversion', () => {
+            const big = new Float64Array(1000).map((_, i) => i * 0.25 - 100);
+            const tree = new expr('a > 0 ? a * b : a / b', ['a', 'b']);
+            const e = new expr('a > 0 ? a * b : a / b', ['a', 'b'], undefined, { backend: 'block' });
+            assert.deepEqual(e.cwise({ a: big, b: 3 }), tree.cwise({ a: big, b: 3 }));
+            assert.deepEqual(e.cwise(e.maxParallel, { a: big, b: 3 }, new Float32Array(1000)),
+                tree.cwise({ a: big, b: 3 }, new Float32Array(1000)));
+        });
+        it('should evaluate polynomials with the SIMD kernels', () => {
+            const x = new Float64Array(1001).map((_, i) => i / 8 - 60);
+            const f = '3 * x^3 - x * x / 4 + c * x + 1';
+            const r1 = new expr(f, ['x', 'c']).map(x, 'x', 5);
+            const r2 = new expr(f, ['x', 'c'], undefined, { backend: 'block' }).map(x, 'x', 5);
+            for (let i = 0; i < x.length; i++)
+                assert.closeTo(r2[i], r1[i], 1e-10 * Math.max(1, Math.abs(x[i]) ** 3));
+
+            const i32 = new Int32Array(1001).map((_, i) => i - 500);
+            const g = '3 * x^3 - x * x + c * x + 1';
+            const tree = new Expression.Int32(g, ['x', 'c']);
+            const block = new Expression.Int32(g, ['x', 'c'], undefined, { backend: 'block' });
+            assert.deepEqual(block.map(i32, 'x', 5), tree.map(i32, 'x', 5));
+            assert.deepEqual(block.cwise({ x: i32, c: 5 }), tree.cwise({ x: i32, c: 5 }));
+        });
+        it('should not evaluate the untaken branch of integer conditionals', () => {
+            const a = new Int32Array(1000).map((_, i) => i);
+            const b = new Int32Array(1000).map((_, i) => i % 3);
+            const e = new Expression.Int32('b != 0 ? a / b : -1', ['a', 'b'], undefined, { backend: 'block' });
+            assert.equal(e.backend, 'block');
+            const r = e.cwise({ a, b });
+            for (let i = 0; i < a.length; i++)
+                assert.equal(r[i], b[i] ? Math.trunc(a[i] / b[i]) : -1);
+        });
+        it('should fall back to the tree for expressions that cannot be lowered', () => {
+            const e = new expr('var s := 0; for (var i := 0; i < a; i += 1) { s += i }; s', ['a'], undefined,
+                { backend: 'vm' });
+            assert.equal(e.backend, 'tree');
+            assert.equal(e.eval(5), 10);
+        });
+        it('should throw on invalid backend', () => {
+            assert.throws(() => {
+                new (expr as any)('a * b', ['a', 'b'], undefined, { backend: 'jit' });
+            }, /backend must be/);
+        });
+    });
+
+    describe('pipeline', () => {
+        const scale = new expr('a * x + b', ['a', 'x', 'b']);
+        const limit = new expr('clamp(0, y, 1)', ['y']);
+        const smooth = new expr('var t := z * z; t * (3 - 2 * z)', ['z']);
+        const input = new Float64Array(1000).map((_, i) => i / 500 - 1);
+        const chained = smooth.map(limit.map(scale.map(input, 'x', { a: 2, b: 0.5 }), 'y'), 'z');
+
+        it('should produce the same result as chained map()', () => {
+            const pipeline = expr.pipeline([scale, 'x', limit, 'y', smooth, 'z']);
+            assert.instanceOf(pipeline, expr);
+            assert.sameMembers(pipeline.scalars, ['a', 'x', 'b']);
+            assert.deepEqual(pipeline.map(input, 'x', { a: 2, b: 0.5 }), chained);
+            assert.deepEqual(pipeline.map(pipeline.maxParallel, input, 'x', { a: 2, b: 0.5 }), chained);
+        });
+        it('should support the async variants', () => {
+            const pipeline = Expression.Expression.pipeline([scale, 'x', limit, 'y', smooth, 'z']);
+            return assert.eventually.deepEqual(
+                (pipeline as expr).mapAsync(pipeline.maxParallel, input, 'x', { a: 2, b: 0.5 }), chained);
+        });
+        it('should share the arguments by name', () => {
+            const pipeline = expr.pipeline([
+                scale, 'x',
+                new expr('y + a', ['y', 'a']), 'y',
+                new expr('z - a', ['z', 'a']), 'z'
+            ]);
+            assert.sameMembers(pipeline.scalars, ['a', 'x', 'b']);
+            assert.equal(pipeline.eval({ a: 2, x: 3, b: 1 }), 7);
+        });
+        it('should throw on invalid stages', () => {
+            assert.throws(() => expr.pipeline([scale]), /stages must be an array/);
+            assert.throws(() => expr.pipeline([scale, 'q']), /q is not a scalar variable of stage 0/);
+            assert.throws(() => expr.pipeline([scale, 'x', new Expression.Float32('y', ['y']), 'y']),
+                /stage 1 is not a Float64/);
+            assert.throws(() => expr.pipeline([scale, 'x', new expr('a * 2', ['a']), 'a']),
+                /a is already an argument of the pipeline/);
+            assert.throws(() => expr.pipeline([scale, 'x', limit, 'y', new expr('z - y', ['z', 'y']), 'z']),
+                /y is an intermediate result of the pipeline/);
+            assert.throws(() => expr.pipeline([scale, 'x', new expr('y + x', ['y', 'x']), 'y']),
+                /x is the iterator variable of the pipeline/);
+            assert.throws(() => expr.pipeline([new expr('v[0] + x', ['x'], { v: 2 }), 'x']),
+                /pipeline stages cannot have vector arguments/);
+        });
+    });
+
+    describe('multiple return values', () => {
+        const polar = new expr('return [hypot(x, y), atan2(y, x)]', ['x', 'y']);
+        const sincos = new expr('return [sin(a * t), cos(a * t)]', ['t', 'a']);
+        const x = new Float64Array(1000).map((_, i) => i - 500);
+        const y = new Float64Array(1000).map((_, i) => 250 - i / 2);
+
+        it('should write every value into its own array with map()', () => {
+            const targets = [new Float64Array(x.length), new Float64Array(x.length)];
+            const r = sincos.map(sincos.maxParallel, targets, x, 't', { a: 0.01 });
+            assert.strictEqual(r, targets);
+            for (let i = 0; i < x.length; i++) {
+                assert.closeTo(r[0][i], Math.sin(0.01 * x[i]), 1e-12);
+                assert.closeTo(r[1][i], Math.cos(0.01 * x[i]), 1e-12);
+            }
+        });
+        it('should write every value into its own array with cwise()', () => {
+            const targets = [new Float64Array(x.length), new Float32Array(x.length)];
+            const r = polar.cwise(polar.maxParallel, { x, y }, targets);
+            assert.strictEqual(r, targets);
+            for (let i = 0; i < x.length; i++) {
+                assert.closeTo(r[0][i], Math.hypot(x[i], y[i]), 1e-9);
+                assert.closeTo(r[1][i], Math.atan2(y[i], x[i]), 1e-6);
+            }
+        });
+        it('should support the async variants', () => {
+            const targets = [new Float64Array(x.length), new Float64Array(x.length)];
+            return assert.isFulfilled(polar.cwiseAsync({ x, y }, targets).then((r) => {
+                assert.strictEqual(r, targets);
+                const ref = polar.cwise({ x, y }, [new Float64Array(x.length), new Float64Array(x.length)]);
+                assert.deepEqual(r[0], ref[0]);
+            }));
+        });
+        it('should throw if the number of values does not match', () => {
+            assert.throws(() => {
+                polar.cwise({ x, y }, [new Float64Array(x.length)]);
+            }, /number of returned values does not match/);
+            assert.throws(() => {
+                sincos.map([new Float64Array(x.length)], x, 't', 1);
+            }, /number of returned values does not match/);
+            assert.throws(() => {
+                new expr('x + 1', ['x']).map([new Float64Array(x.length), new Float64Array(x.length)], x, 'x');
+            }, /number of returned values does not match/);
+        });
+        it('should throw on invalid target arrays', () => {
+            assert.throws(() => {
+                sincos.map([new Float32Array(x.length) as unknown as Float64Array], x, 't', 1);
+            }, /target arrays must be Float64Arrays/);
+            assert.throws(() => {
+                sincos.map([new Float64Array(x.length), new Float64Array(2)], x, 't', 1);
+            }, /all target arrays must have the same size/);
+            assert.throws(() => {
+                polar.cwise({ x, y }, [new Float64Array(x.length), new Float64Array(2)]);
+            }, /target array cannot hold the result/);
+        });
+    });
+
+    describe('schedule', () => {
+        // The cost per element grows with the input
+        const collatz = new expr(
+            'var n := x; var steps := 0; while (n > 1) { n := (n % 2 == 0) ? n / 2 : 3 * n + 1; steps += 1; }; steps',
+            ['x']);
+        const input = new Float64Array(50000).map((_, i) => i + 1);
+        const expected = collatz.map(input, 'x');
+
+        it('should be static by default', () => {
+            assert.equal(collatz.schedule, 'static');
+        });
+        it('should produce the same result with the dynamic schedule', () => {
+            const dynamic = new expr(collatz.expression, ['x'], undefined, { schedule: 'dynamic' });
+            assert.equal(dynamic.schedule, 'dynamic');
+            assert.deepEqual(dynamic.map(dynamic.maxParallel, input, 'x'), expected);
+            assert.deepEqual(dynamic.cwise(dynamic.maxParallel, { x: input }), expected);
+            assert.deepEqual(dynamic.cwise(3, { x: new Uint32Array(input) }, new Float32Array(input.length)),
+                new Float32Array(expected));
+        });
+        it('should support the async variants', () => {
+            const dynamic = new expr(collatz.expression, ['x'], undefined, { schedule: 'dynamic' });
+            return assert.eventually.deepEqual(dynamic.mapAsync(dynamic.maxParallel, input, 'x'), expected);
+        });
+        it('should support changing the schedule between calls', () => {
+            const e = new expr('return [x * 2, x - 1]', ['x']);
+            e.schedule = 'dynamic';
+            const r = e.cwise(e.maxParallel, { x: input },
+                [new Float64Array(input.length), new Int32Array(input.length)]);
+            e.schedule = 'static';
+            assert.equal(e.schedule, 'static');
+            assert.deepEqual(r[0], input.map((x) => x * 2));
+            assert.deepEqual(r[1], new Int32Array(input.map((x) => x - 1)));
+        });
+        it('should throw on invalid values', () => {
+            assert.throws(() => {
+                (collatz as any).schedule = 'guided';
+            }, /schedule must be 'static' or 'dynamic'/);
+            assert.throws(() => {
+                new (expr as any)('x', ['x'], undefined, { schedule: 12 });
+            }, /schedule must be 'static' or 'dynamic'/);
+        });
+    });
+
+    describe('automatic threads', () => {
+        const small = new Float64Array(16).map((_, i) => i);
+        const large = new Float64Array(1024 * 1024).map((_, i) => i);
+
+        it('should use a single thread for small arrays', () => {
+            const e = new expr('x * 2', ['x']);
+            assert.deepEqual(e.map('auto', small, 'x'), small.map((x) => x * 2));
+            assert.deepEqual(e.cwise('auto', { x: small }), small.map((x) => x * 2));
+            assert.equal(e.maxActive, 1);
+        });
+        it('should use several threads for large arrays', function () {
+            if (os.cpus().length < 2) this.skip();
+            const e = new expr('2 * cos(x) / (sqrt(x) + 1)', ['x']);
+            assert.deepEqual(e.map('auto', large, 'x'), large.map((x) => 2 * Math.cos(x) / (Math.sqrt(x) + 1)));
+            assert.isAbove(e.maxActive, 1);
+        });
+        it('should support the async variants', async () => {
+            const e = new expr('x * 2', ['x']);
+            assert.deepEqual(await e.mapAsync('auto', large, 'x'), large.map((x) => x * 2));
+            assert.deepEqual(await e.cwiseAsync('auto', { x: large }), large.map((x) => x * 2));
+            assert.deepEqual(await e.mapAsync('auto', small, 'x'), small.map((x) => x * 2));
+        });
+        it('should throw on invalid values', () => {
+            const e = new expr('x * 2', ['x']);
+            assert.throws(() => {
+                e.map('many' as any, small, 'x');
+            }, /threads must be a number or 'auto'/);
+            assert.throws(() => {
+                e.cwise('many' as any, { x: small });
+            }, /threads must be a number or 'auto'/);
+        });
+    });
+
+    describe('priority', () => {
+        const input = new Float64Array(100000).map((_, i) => i);
+
+        it('should be normal by default', () => {
+            assert.equal(new expr('x * 2', ['x']).priority, 'normal');
+        });
+        it('should produce the same result in the bulk class', () => {
+            const bulk = new expr('x * 2', ['x'], undefined, { priority: 'bulk' });
+            assert.equal(bulk.priority, 'bulk');
+            assert.deepEqual(bulk.map(bulk.maxParallel, input, 'x'), input.map((x) => x * 2));
+            assert.deepEqual(bulk.cwise(bulk.maxParallel, { x: input }), input.map((x) => x * 2));
+            bulk.schedule = 'dynamic';
+            assert.deepEqual(bulk.cwise(3, { x: input }, new Float32Array(input.length)),
+                new Float32Array(input.map((x) => x * 2)));
+        });
+        it('should count the queue wait per class', async () => {
+            const high = new expr('x * 2', ['x'], undefined, { priority: 'high' });
+            const before = expr.queueStats.high.count;
+            assert.deepEqual(await high.mapAsync(high.maxParallel, input, 'x'), input.map((x) => x * 2));
+            assert.equal(await high.evalAsync(4), 8);
+            const stats = expr.queueStats;
+            assert.equal(stats.high.count, before + high.maxParallel + 1);
+            assert.isAtLeast(stats.high.totalWait, 0);
+            assert.isAtLeast(stats.high.maxWait, 0);
+            assert.hasAllKeys(stats, ['high', 'normal', 'bulk']);
+        });
+        it('should throw on invalid values', () => {
+            const e = new expr('x * 2', ['x']);
+            assert.throws(() => {
+                (e as any).priority = 'urgent';
+            }, /priority must be 'high', 'normal' or 'bulk'/);
+            assert.throws(() => {
+                new (expr as any)('x', ['x'], undefined, { priority: 1 });
+            }, /priority must be 'high', 'normal' or 'bulk'/);
+        });
+    });
+
+    describe('cancellation', () => {
+        const forever = 'var i := 0; while (x > 0) { i += 1 }; i';
+        const input = new Float64Array(1000).fill(1);
+
+        it('should reject immediately with an already aborted signal', () => {
+            const e = new expr(forever, ['x']);
+            const ctrl = new AbortController();
+            ctrl.abort();
+            return assert.isRejected(e.evalAsync({ x: 1 }, ctrl.signal), /aborted/);
+        });
+        it('should resolve normally when the signal is not aborted', async () => {
+            const e = new expr('x * 2', ['x']);
+            const ctrl = new AbortController();
+            assert.equal(await e.evalAsync({ x: 2 }, ctrl.signal), 4);
+            assert.deepEqual(await e.mapAsync(2, input, 'x', {}, ctrl.signal), input.map((x) => x * 2));
+        });
+        it('should interrupt a running evalAsync() and free the instance', async () => {
+            const e = new expr(forever, ['x'], undefined, { maxParallel: 1 });
+            const ctrl = new AbortController();
+            const q = e.evalAsync({ x: 1 }, ctrl.signal);
+            setTimeout(() => ctrl.abort(), 50);
+            await assert.isRejected(q, /aborted/);
+            // This can run only once the aborted loop has released the only instance
+            assert.equal(await e.evalAsync({ x: 0 }), 0);
+        });
+        it('should leave the callback untouched', (done) => {
+            const e = new expr(forever, ['x'], undefined, { maxParallel: 1 });
+            const ctrl = new AbortController();
+            const cb = (err: Error | null) => {
+                try {
+                    assert.match(String(err), /aborted/);
+                    assert.deepEqual(Object.keys(cb), []);
+                    done();
+                } catch (e) {
+                    done(e);
+                }
+            };
+            (e as any).evalAsync({ x: 1 }, ctrl.signal, cb);
+            assert.deepEqual(Object.keys(cb), []);
+            setTimeout(() => ctrl.abort(), 50);
+        });
+        it('should support deadlines with AbortSignal.timeout()', async () => {
+            const e = new expr(forever, ['x'], undefined, { maxParallel: 1 });
+            await assert.isRejected(e.mapAsync(e.maxParallel, input, 'x', {}, AbortSignal.timeout(50)),
+                /timeout|timed out/i);
+            await assert.isRejected(e.cwiseAsync({ x: input }, AbortSignal.timeout(50)), /timeout|timed out/i);
+            assert.equal(e.eval({ x: 0 }), 0);
+        });
+        it('should support the callback form', (done) => {
+            const e = new expr(forever, ['x']);
+            const ctrl = new AbortController();
+            (e as any).evalAsync({ x: 1 }, ctrl.signal, (err: Error | null, r: number | undefined) => {
+                try {
+                    assert.instanceOf(err, Error);
+                    assert.match((err as Error).message, /aborted/);
+                    assert.isUndefined(r);
+                    done();
+                } catch (failed) {
+                    done(failed);
+                }
+            });
+            setTimeout(() => ctrl.abort(), 10);
+        });
+    });
+
+    describe('admission control', () => {
+        it('should be unlimited by default', () => {
+            const e = new expr('x * 2', ['x']);
+            assert.equal(e.maxQueued, 0);
+            assert.equal(e.overflow, 'reject');
+            assert.equal(expr.maxQueued, 0);
+        });
+        it('should reject the calls over the limit of an Expression', async () => {
+            const e = new expr('x * 2', ['x'], undefined, { maxQueued: 2 });
+            const before = expr.admissionStats;
+            const q1 = e.evalAsync({ x: 1 });
+            const q2 = e.evalAsync({ x: 2 });
+            const q3 = e.evalAsync({ x: 3 });
+            await assert.isRejected(q3, /too many pending asynchronous calls of this Expression/);
+            await q3.catch((err) => assert.equal(err.code, 'EXPRTKJS_QUEUE_FULL'));
+            assert.deepEqual(await Promise.all([q1, q2]), [2, 4]);
+            const stats = expr.admissionStats;
+            assert.equal(stats.queued, before.queued + 2);
+            assert.equal(stats.rejected, before.rejected + 1);
+            assert.isAtMost(stats.pending, before.pending);
+            assert.equal(await e.evalAsync({ x: 4 }), 8);
+        });
+        it('should reject the calls over the process-wide limit', async () => {
+            const e1 = new expr('x * 2', ['x']);
+            const e2 = new expr('x * 3', ['x']);
+            try {
+                expr.maxQueued = 2;
+                const q = [e1.evalAsync({ x: 1 }), e2.evalAsync({ x: 1 })];
+                await assert.isRejected(e1.evalAsync({ x: 1 }), /Expression.maxQueued/);
+                assert.throws(() => {
+                    e2.evalAsync({ x: 1 }, () => undefined);
+                }, /Expression.maxQueued/);
+                assert.deepEqual(await Promise.all(q), [2, 3]);
+            } finally {
+                expr.maxQueued = 0;
+            }
+        });
+        it('should hold the calls over the limit with the wait policy', async () => {
+            const e = new expr('x * 2', ['x'], undefined, { maxQueued: 1, overflow: 'wait' });
+            const input = new Float64Array(1000).map((_, i) => i);
+            const before = expr.admissionStats;
+            const q = [];
+            for (let i = 0; i < 16; i++) q.push(e.mapAsync(input, 'x'));
+            q.push(e.evalAsync({ x: 3 }));
+            const r = await Promise.all(q);
+            for (let i = 0; i < 16; i++) assert.deepEqual(r[i], input.map((x) => x * 2));
+            assert.equal(r[16], 6);
+            assert.equal(expr.admissionStats.rejected, before.rejected);
+            assert.equal(expr.admissionStats.queued, before.queued + 17);
+        });
+        it('should support aborting a waiting call', async () => {
+            const e = new expr('x * 2', ['x'], undefined, { maxQueued: 1, overflow: 'wait' });
+            const ctrl = new AbortController();
+            const q1 = e.evalAsync({ x: 1 });
+            const q2 = e.evalAsync({ x: 2 }, ctrl.signal);
+            const q3 = e.evalAsync({ x: 3 });
+            ctrl.abort();
+            await assert.isRejected(q2, /aborted/);
+            assert.deepEqual(await Promise.all([q1, q3]), [2, 6]);
+        });
+        it('should not hold the calls of an Expression behind another one', async () => {
+            const slow = new expr('var s := 0; for (var i := 0; i < 1e12; i += 1) { s += x }; s', ['x'],
+                undefined, { maxQueued: 1, overflow: 'wait' });
+            const fast = new expr('x * 2', ['x'], undefined, { overflow: 'wait' });
+            const ctrl = new AbortController();
+            const q1 = slow.evalAsync({ x: 1 }, ctrl.signal);
+            const q2 = slow.evalAsync({ x: 2 }, ctrl.signal);
+            let settled = false;
+            q2.catch(() => undefined).finally(() => {
+                settled = true;
+            });
+            // `slow` has reached its own limit, `fast` does not wait behind it
+            assert.equal(await fast.evalAsync({ x: 3 }), 6);
+            assert.isFalse(settled);
+            ctrl.abort();
+            await assert.isRejected(q1, /aborted/);
+            await assert.isRejected(q2, /aborted/);
+        });
+        it('should retry the waiting calls when another env frees a slot', async () => {
+            const slow = new expr('var s := 0; for (var i := 0; i < 1e12; i += 1) { s += x }; s', ['x']);
+            const ctrl = new AbortController();
+            const testCode = `
+                const { parentPort } = require('worker_threads');
+                const expr = require(${JSON.stringify(require.resolve('exprtk.js'))}).Float64;
+                const e = new expr('x * 2', ['x'], undefined, { overflow: 'wait' });
+                e.evalAsync({ x: 4 }).then((r) => parentPort.postMessage({ r }));
+                parentPort.postMessage({ waiting: true });
+            `;
+            try {
+                expr.maxQueued = 1;
+                const q = slow.evalAsync({ x: 1 }, ctrl.signal);
+                const worker = new Worker(testCode, { eval: true });
+                const messages: any[] = [];
+                const result = new Promise<any>((resolve, reject) => {
+                    worker.on('message', (msg) => {
+                        messages.push(msg);
+                        if (msg.r !== undefined) resolve(msg.r);
+                    });
+                    worker.once('error', reject);
+                });
+                await new Promise<void>((resolve) => worker.once('message', () => resolve()));
+                await new Promise((resolve) => setTimeout(resolve, 50));
+                // The worker has nothing in flight, only the slot freed here can wake it up
+                assert.deepEqual(messages, [{ waiting: true }]);
+                ctrl.abort();
+                await assert.isRejected(q, /aborted/);
+                assert.equal(await result, 8);
+                await worker.terminate();
+            } finally {
+                expr.maxQueued = 0;
+            }
+        });
+        it('should throw on invalid values', () => {
+            const e = new expr('x * 2', ['x']);
+            assert.throws(() => {
+                (e as any).overflow = 'drop';
+            }, /overflow must be 'reject' or 'wait'/);
+            assert.throws(() => {
+                new (expr as any)('x', ['x'], undefined, { maxQueued: 'many' });
+            }, /maxQueued must be a number/);
+        });
     });
 
     describe('types', () => {
@@ -371,6 +1083,23 @@ describe('Expression', () => {
                     assert.closeTo(r, (5 + 10) / 2, 10e-9);
                 }));
             });
+            it('should create one async context per call when the completions are batched', () => {
+                let asyncHooksCreated = 0;
+                const asyncHook =
+                    asyncHooks.createHook({
+                        init: function init(asyncId, type) {
+                            if (type === 'ExprTk.js:async') asyncHooksCreated++;
+                        }
+                    });
+                asyncHook.enable();
+                const q = [];
+                for (let i = 0; i < 256; i++) q.push(mean.evalAsync(i, 10));
+                return assert.isFulfilled(Promise.all(q).then((r) => {
+                    asyncHook.disable();
+                    assert.equal(asyncHooksCreated, 256);
+                    for (let i = 0; i < 256; i++) assert.closeTo(r[i], (i + 10) / 2, 10e-9);
+                }));
+            });
             it('should pass a this value when used in callback mode', (done) => {
                 mean.evalAsync({ a: 5, b: 10 }, function (e, r) {
                     try {
@@ -424,6 +1153,16 @@ describe('Expression', () => {
                     assert.closeTo(r[i], i + 12, 10e-9);
             });
 
+            it('should run in parallel with async calls using the same instances', async () => {
+                const q = plus.mapAsync(plus.maxParallel, bigarray, 'a', 1);
+                const r = plus.map(plus.maxParallel, bigarray, 'a', 12);
+                const a = await q;
+                for (let i = 0; i < big; i += big / 1024) {
+                    assert.closeTo(r[i], i + 12, 10e-9);
+                    assert.closeTo(a[i], i + 1, 10e-9);
+                }
+            });
+
             it('should support odd-sized subtasks', () => {
                 const r = plus.map(Math.min(expr.maxParallel - 1, 1), bigarray, 'a', 12);
                 assert.instanceOf(r, Float64Array);
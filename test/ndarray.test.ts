@@ -96,6 +96,22 @@ describe('ndarray support', () => {
             assert.isTrue(ops.equals(result.hi(2, 2), expected.hi(2, 2)));
         });
 
+        it('should support the dynamic schedule', () => {
+            const dynamic = new Float64Expression('a + b', ['a', 'b'], undefined, { schedule: 'dynamic' });
+            const a = ndarray(new Float64Array(90 * 100), [90, 100], [1, 90]);
+            const b = ndarray(new Float64Array(90 * 100), [90, 100], [-100, -1], 90 * 100 - 1);
+            for (let y = 0; y < 90; y++)
+                for (let x = 0; x < 100; x++) {
+                    a.set(y, x, y * 100 + x);
+                    b.set(y, x, x * 1000 + y);
+                }
+
+            const r = dynamic.cwise(dynamic.maxParallel, { a, b });
+            assert.deepEqual(r, expr.cwise({ a, b }));
+            assert.deepEqual(dynamic.cwise(dynamic.maxParallel, { a, b }, new Float32Array(r.length)),
+                new Float32Array(r));
+        });
+
         it('should throw with invalid ndarrays', () => {
             assert.throws(() => {
                 expr.cwise({
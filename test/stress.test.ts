@@ -51,4 +51,54 @@ describe('stress', () => {
         .catch((e) => done(e));
     }
   });
+
+  it('concurrent compilation', () => {
+    // Every Expression is new and every joblet will have to compile its own instance
+    const exprs: Float64[] = [];
+    for (let i = 0; i < 16; i++)
+      exprs.push(new Float64(`a * ${i} + b + ${iterations}`));
+    return Promise.all(exprs.map((e) => e.mapAsync(e.maxParallel, arrayInc, 'a', 4)))
+      .then((results) => {
+        for (let i = 0; i < results.length; i++)
+          for (let j = 0; j < size; j += size / 100)
+            assert.closeTo(results[i][j], j * i + 4 + iterations, 1e-9);
+      });
+  });
+
+  it('a busy Expression does not starve the others', () => {
+    // All evaluations of `busy` wait for its only instance and are handed over
+    // from one to the next in the same worker thread
+    const busy = new Float64('a * 2', ['a'], undefined, { maxParallel: 1 });
+    const other = new Float64('a * 3', ['a']);
+    const calls = 4 * iterations;
+    let busyReady = 0;
+    const q: Promise<void>[] = [];
+    for (let i = 0; i < calls; i++)
+      q.push(busy.evalAsync(i).then((r) => {
+        assert.equal(r, i * 2);
+        busyReady++;
+      }));
+    return Promise.all(q.concat([other.evalAsync(5).then((r) => {
+      assert.equal(r, 15);
+      assert.isBelow(busyReady, calls);
+    })]));
+  });
+
+  it('high priority evaluations do not wait for the bulk ones', () => {
+    const big = new Float64Array(size * 400).map((_, i) => i);
+    const bulk = new Float64('sqrt(a) * cos(a)', ['a'], undefined, { priority: 'bulk' });
+    const high = new Float64('a * 2', ['a'], undefined, { priority: 'high' });
+    let bulkReady = 0;
+    const q: Promise<void>[] = [];
+    for (let i = 0; i < 4; i++)
+      q.push(bulk.mapAsync(bulk.maxParallel, big, 'a').then(() => {
+        bulkReady++;
+      }));
+    for (let i = 0; i < iterations; i++)
+      q.push(high.evalAsync(i).then((r) => {
+        assert.equal(r, i * 2);
+        assert.isBelow(bulkReady, 4);
+      }));
+    return Promise.all(q);
+  });
 });